@@ -0,0 +1,261 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// Parser throughput benchmark for the host (pio run -e native), replays
+// all SML messages from testdata.h through readSMLByte() and reports
+// ns/byte, frames/s and worst-case latency per frame for every meter
+// (failing if a message isn't parsed, its checksum isn't reproduced by
+// smlMessageCRC() or a decoded value differs from the expected one).
+// Afterwards BENCH_READERS SMLReaders are fed with replayed messages at
+// full speed to estimate the number of reading heads one CPU can handle,
+// once more with each reader repeating one message like a real meter
+// (read with the learned frame template if SML_FRAME_TEMPLATE is set).
+// With '-f' an SMLReader reads from a file, named pipe or pty instead.
+//
+// Usage: .pio/build/native/program [frames per meter]
+//        .pio/build/native/program -f <file|pty>
+
+#include <chrono>
+#include <unistd.h>
+#include "smlreader.h"
+#include "smlparser.h"
+#include "testdata.h"
+
+#define BENCH_FRAMES_PER_METER 50000
+#define BENCH_READERS 16
+
+typedef std::chrono::steady_clock benchClock;
+
+// decoded readings of every message in testdata.h (same order) with the
+// built-in OBIS registry, values as value * 10^scaler per registry slot
+// (1.8.0, 2.8.0, 16.7.0, 16.7.0 feed-in, 36.7.0, 56.7.0, 76.7.0)
+typedef struct {
+    const char *manufacturer;
+    uint8_t serverId[10];
+    uint8_t serverIdLen;
+    uint32_t present;
+    int64_t value[7];
+    int8_t scaler[7];
+} BenchExpected;
+
+static const BenchExpected BENCH_EXPECTED[] = {
+    { "ISK", { 0x0a, 0x01, 0x49, 0x53, 0x4b, 0x00, 0x04, 0x32, 0x5e, 0xc5 }, 10, 0x05,
+        { 1989273, 0, 26 }, { -1, 0, 0 } },  // 198927Wh, 26W
+    { "EBZ", { 0x09, 0x01, 0x45, 0x42, 0x5a, 0x01, 0x00, 0x10, 0x4c, 0x78 }, 10, 0x01,
+        { 4469 }, { 3 } },  // 4469000Wh
+    { "HLY", { 0x0a, 0x01, 0x48, 0x4c, 0x59, 0x02, 0x00, 0x0d, 0x6b, 0xe6 }, 10, 0x05,
+        { 23559290, 0, 376 }, { -1, 0, 0 } },  // 2355929Wh, 376W
+    { "ITR", { 0x0a, 0x01, 0x49, 0x54, 0x52, 0x00, 0x03, 0x47, 0xf0, 0x40 }, 10, 0x05,
+        { 258927761, 0, 542 }, { -1, 0, 0 } },  // 25892776Wh, 542W
+    { "ISK", { 0x0a, 0x01, 0x49, 0x53, 0x4b, 0x00, 0x04, 0x54, 0xa9, 0x5f }, 10, 0x05,
+        { 168248565, 0, 0 }, { -1, 0, 0 } },  // 16824856Wh, 0W
+    { "DZG", { 0x0a, 0x01, 0x44, 0x5a, 0x47, 0x00, 0x03, 0x9e, 0x20, 0x54 }, 10, 0x07,
+        { 6074471, 12667286, 21599 }, { -1, -1, -2 } },  // 607447Wh, 215W
+    { "EMH", { 0x06, 0x45, 0x4d, 0x48, 0x01, 0x02, 0x71, 0x58, 0x20, 0x51 }, 10, 0x09,
+        { 133124849, 0, 0, 1394 }, { -1, 0, 0, -1 } },  // 13312484Wh, 139.4W
+    { "DNT", { 0x09, 0x01, 0x44, 0x4e, 0x54, 0x01, 0x00, 0x00, 0x20, 0x30 }, 10, 0x0a,
+        { 0, 43730, 0, 0 }, { 0, -1, 0, 0 } },  // 4373Wh, 0W
+    { "ISK", { 0x09, 0x01, 0x49, 0x53, 0x4b, 0x00, 0x04, 0x03, 0xdf, 0x63 }, 10, 0x75,
+        { 224624136, 0, 168, 0, 117, 22, 29 }, { -1, 0, 0, 0, 0, 0, 0 } },  // 22462413Wh, 168W
+    { "ISK", { 0x06, 0x49, 0x53, 0x4b, 0x01, 0x0e, 0x1f, 0x66, 0x29, 0x9a }, 10, 0x77,
+        { 107323091, 282753245, -4308, 0, -1392, -1432, -1482 },
+        { -1, -1, 0, 0, 0, 0, 0 } },  // 10732309Wh, 28275324Wh
+    { "ESY", { 0x09, 0x01, 0x45, 0x53, 0x59, 0x11, 0x03, 0xb5, 0x99, 0xa5 }, 10, 0x77,
+        { 29416461614, 1100731603, 81026, 0, 50523, 6319, 24183 },
+        { -4, -4, -2, 0, -2, -2, -2 } }  // 2941646Wh, 810W
+};
+
+
+static const char* stateStr(sml_states_t state) {
+    switch (state) {
+        case SML_FINAL: return "ok";
+        case SML_CHECKSUM_ERROR: return "checksum";
+        case SML_END: return "buffer";
+        case SML_CHECKSUM: return "crc";
+        default: return "incomplete";
+    }
+}
+
+
+// feed one SML message into parser, returns parser state
+// when message was completed or SML_START if it wasn't
+static sml_states_t replayFrame(const uint8_t *data, uint16_t size,
+        SMLParserContext *ctx, SMLDeviceReadings *readings) {
+    sml_states_t state = SML_START;
+    for (uint16_t i = 0; i < size; i++) {
+        if (readSMLByte(data[i], ctx, readings))
+            state = (sml_states_t)readings->state;
+    }
+    return state;
+}
+
+
+// compare decoded message with expected manufacturer, server id and values
+static bool checkReadings(const SMLDeviceReadings &readings, const BenchExpected &expected) {
+    if (strcmp((const char*)readings.manufacturer, expected.manufacturer) ||
+            readings.serverIdLen != expected.serverIdLen ||
+            memcmp(readings.serverId, expected.serverId, expected.serverIdLen) ||
+            readings.present != expected.present)
+        return false;
+    for (uint8_t slot = 0; slot < 7; slot++) {
+        if ((expected.present & (1 << slot)) && (readings.value[slot] != expected.value[slot] ||
+                readings.scaler[slot] != expected.scaler[slot]))
+            return false;
+    }
+    return true;
+}
+
+
+// checksum of message as received (little-endian after the end sequence)
+// compared with the one calculated four bytes at a time
+static bool checkCRC(const uint8_t *data, uint16_t size) {
+    return (smlMessageCRC(data + 4, size - 6) == (data[size - 2] | (data[size - 1] << 8)));
+}
+
+
+// throughput of the slice-by-4 checksum used for complete messages
+static volatile uint16_t crcSink;  // keeps calls from being optimized away
+
+static void crcTest(uint32_t rounds) {
+    const uint8_t meters = sizeof(SML_TESTDATA_SIZE) / sizeof(SML_TESTDATA_SIZE[0]);
+    uint64_t bytes = 0, ns;
+
+    benchClock::time_point start = benchClock::now();
+    for (uint32_t i = 0; i < rounds; i++) {
+        for (uint8_t m = 0; m < meters; m++) {
+            crcSink = smlMessageCRC(SML_TESTDATA[m] + 4, SML_TESTDATA_SIZE[m] - 6);
+            bytes += SML_TESTDATA_SIZE[m] - 6;
+        }
+    }
+    ns = std::chrono::duration_cast<std::chrono::nanoseconds>(benchClock::now() - start).count();
+    printf("\nCRC16/X.25 of complete messages: %.2f ns/byte\n", (double)ns / bytes);
+}
+
+
+// feed all readers round-robin just like the reader scheduler on the ESP32
+static void loadTest(uint32_t rounds, bool repeat) {
+    std::list<SMLReader*> readers;
+    std::list<SMLReader*>::iterator it;
+    uint64_t bytes, ns;
+
+    for (uint8_t i = 0; i < BENCH_READERS; i++)
+        readers.push_back(new SMLReader(i, new ReplaySource(0, i, repeat)));
+
+    benchClock::time_point start = benchClock::now();
+    for (uint32_t i = 0; i < rounds; i++) {
+        for (it = readers.begin(); it != readers.end(); ++it)
+            (*it)->read(SML_SCHEDULER_BUDGET);
+    }
+    ns = std::chrono::duration_cast<std::chrono::nanoseconds>(benchClock::now() - start).count();
+    bytes = (uint64_t)rounds * BENCH_READERS * SML_SCHEDULER_BUDGET;
+
+    printf("\n%d SMLReaders with %s messages: %.2f ns/byte, %.0f bytes/s",
+        BENCH_READERS, repeat ? "repeated" : "replayed", (double)ns / bytes, bytes / (ns / 1e9));
+    printf(" (%.0f reading heads at 9600 baud)\n", bytes / (ns / 1e9) / 960);
+
+    for (it = readers.begin(); it != readers.end(); ++it)
+        delete *it;
+}
+
+
+// print readings of all messages read from given file or pty
+static int readFile(const char *path) {
+    FileSource *source = new FileSource(path);
+    SMLReader reader(0, source);
+
+    if (!source->isOpen()) {
+        perror(path);
+        return 1;
+    }
+    nativeSerialEnabled() = true;
+    while (1) {
+        if (!reader.read() && source->available() <= 0) {
+            reader.printReadings();
+            fflush(stdout);
+            sleep(1);
+        }
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    const uint8_t meters = sizeof(SML_TESTDATA_SIZE) / sizeof(SML_TESTDATA_SIZE[0]);
+    uint32_t frames = BENCH_FRAMES_PER_METER;
+    uint64_t totalNs = 0, totalBytes = 0, totalFrames = 0;
+    SMLParserContext ctx;
+    SMLDeviceReadings readings;
+    sml_states_t state;
+    bool valid;
+    int rc = 0;
+
+    static_assert(sizeof(BENCH_EXPECTED) / sizeof(BENCH_EXPECTED[0]) == meters,
+        "expected readings missing for test data");
+    loadOBISRegistry();  // built-in registry on host
+    if (argc > 2 && strcmp(argv[1], "-f") == 0)
+        return readFile(argv[2]);
+    if (argc > 1 && atol(argv[1]) > 0)
+        frames = atol(argv[1]);
+
+    printf("Replaying %u frames per meter through readSMLByte()\n\n", frames);
+    printf("%-36s %5s %-10s %8s %10s %10s\n",
+        "Meter", "Bytes", "State", "ns/byte", "frames/s", "max us");
+
+    for (uint8_t m = 0; m < meters; m++) {
+        uint64_t ns = 0, worstNs = 0;
+
+        memset(&readings, 0, sizeof(readings));
+        resetSMLParser(&ctx);
+        resetSMLReadings(&readings);
+        state = replayFrame(SML_TESTDATA[m], SML_TESTDATA_SIZE[m], &ctx, &readings);
+        if (state == SML_FINAL && !checkCRC(SML_TESTDATA[m], SML_TESTDATA_SIZE[m]))
+            state = SML_CHECKSUM;
+        valid = (state == SML_FINAL && checkReadings(readings, BENCH_EXPECTED[m]));
+        if (!valid)
+            rc = 1;
+
+        for (uint32_t i = 0; i < frames; i++) {
+            benchClock::time_point start = benchClock::now();
+            replayFrame(SML_TESTDATA[m], SML_TESTDATA_SIZE[m], &ctx, &readings);
+            uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                benchClock::now() - start).count();
+            ns += elapsed;
+            if (elapsed > worstNs)
+                worstNs = elapsed;
+        }
+
+        printf("%-36s %5u %-10s %8.2f %10.0f %10.2f\n",
+            SML_TESTDATA_NAME[m], SML_TESTDATA_SIZE[m],
+            (state == SML_FINAL && !valid) ? "values" : stateStr(state),
+            (double)ns / ((uint64_t)frames * SML_TESTDATA_SIZE[m]),
+            frames / (ns / 1e9), worstNs / 1e3);
+        totalNs += ns;
+        totalBytes += (uint64_t)frames * SML_TESTDATA_SIZE[m];
+        totalFrames += frames;
+    }
+
+    printf("\n%-36s %5s %-10s %8.2f %10.0f\n", "All meters", "", "",
+        (double)totalNs / totalBytes, totalFrames / (totalNs / 1e9));
+
+    crcTest(frames / 10);
+    loadTest(totalBytes / BENCH_READERS / SML_SCHEDULER_BUDGET, false);
+    loadTest(totalBytes / BENCH_READERS / SML_SCHEDULER_BUDGET, true);
+    return rc;
+}
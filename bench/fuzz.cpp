@@ -0,0 +1,308 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// Fuzz harness for the SML parser on the host (pio run -e fuzz), feeds
+// malformed input through an SMLReader (readSMLByte(), scanSMLStart(), the
+// OBIS handlers and the frame template) and fails if it crashes or exceeds
+// the time per byte or per message or the stack depth given below. The
+// budgets are for the host, the ESP32 (80 MHz) is roughly 20 times slower.
+// About 3.5 KB of stack are taken by printf() of the host's C library for log
+// messages, so the stack budget only guards against growth; the headroom of
+// the reader task (2048 bytes) on the ESP32 is shown by the task profiler.
+//
+// Without libFuzzer the harness mutates the messages from testdata.h:
+//   .pio/build/fuzz/program [iterations] [seed]
+//   .pio/build/fuzz/program -c <dir>        write seed corpus
+//   .pio/build/fuzz/program <file> ...      replay inputs (e.g. crashes)
+//
+// With libFuzzer (clang) the standalone main() is left out:
+//   clang++ -g -O1 -fsanitize=fuzzer,address,undefined -DSML_LIBFUZZER
+//     -DSML_NATIVE -DDEBUG_TESTDATA -DSML_FRAME_TEMPLATE -Inative -Iinclude
+//     bench/fuzz.cpp src/{smldecoder,smlparser,smlhandler,obisregistry,log,utils,
+//     bytesource,smlreader,framepool,capture,aggregate}.cpp -o fuzz
+//   ./fuzz -max_len=4096 corpus/
+
+#include <chrono>
+#include <vector>
+#include "smlreader.h"
+#include "smlparser.h"
+#include "testdata.h"
+
+#define FUZZ_BYTE_BUDGET_US 100  // parse time of a single byte
+#define FUZZ_FRAME_BUDGET_US 5000  // parse time of a message
+#define FUZZ_STACK_BUDGET 6144  // bytes of stack below SMLReader::read()
+#define FUZZ_STACK_PAINT 16384
+#define FUZZ_RETRIES 4  // runs of a slow input, fastest one counts
+#define FUZZ_ITERATIONS 20000
+#define FUZZ_SEED_FRAMES 3  // copies of a message per seed (frame template)
+#define FUZZ_MAX_INPUT 4096
+
+// AddressSanitizer moves and pads stack frames and slows down the parser,
+// only crashes are reported then
+#if defined(__SANITIZE_ADDRESS__)
+#define FUZZ_SANITIZED
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define FUZZ_SANITIZED
+#endif
+#endif
+
+typedef std::chrono::steady_clock fuzzClock;
+
+// worst case of a single input
+typedef struct {
+    uint32_t byteNs;
+    uint32_t frameMicros;
+    uint32_t stackBytes;
+} FuzzResult;
+
+static FuzzResult worst;
+static uint64_t totalInputs, totalBytes;
+
+
+// fuzz input as source of an SMLReader
+class BufferSource : public ByteSource {
+    public:
+        BufferSource(const uint8_t *data, size_t size) : data(data), size(size) {}
+        int available() { return this->size - this->pos; }
+        int read() { return (this->pos < this->size) ? this->data[this->pos++] : -1; }
+        int read(uint8_t *buf, int size) {
+            int len = ((size_t)size < this->size - this->pos) ? size : this->size - this->pos;
+            memcpy(buf, this->data + this->pos, len);
+            this->pos += len;
+            return len;
+        }
+    private:
+        const uint8_t *data;
+        size_t size;
+        size_t pos = 0;
+};
+
+
+// fill unused stack below caller with a pattern...
+static uintptr_t stackArea;
+
+static void __attribute__((noinline)) paintStack() {
+    volatile uint8_t area[FUZZ_STACK_PAINT];
+    for (uint32_t i = 0; i < sizeof(area); i++)
+        area[i] = 0xA5;
+    stackArea = (uintptr_t)area;
+}
+
+
+// ...and find deepest byte overwritten since (called from same frame)
+static uint32_t stackDepth() {
+    uint32_t i = 0;
+
+    while (i < FUZZ_STACK_PAINT && ((const volatile uint8_t*)stackArea)[i] == 0xA5)
+        i++;
+    return FUZZ_STACK_PAINT - i;
+}
+
+
+// feed input byte by byte into a fresh reader
+static FuzzResult runInput(SMLReader *reader, const uint8_t *data, size_t size) {
+    FuzzResult result = { 0, 0, 0 };
+    uint32_t ns;
+
+    reader->begin(0, new BufferSource(data, size));
+#ifndef FUZZ_SANITIZED
+    paintStack();
+#endif
+    for (size_t i = 0; i < size; i++) {
+        fuzzClock::time_point start = fuzzClock::now();
+        reader->read(1);
+        ns = std::chrono::duration_cast<std::chrono::nanoseconds>(fuzzClock::now() - start).count();
+        if (ns > result.byteNs)
+            result.byteNs = ns;
+    }
+#ifndef FUZZ_SANITIZED
+    result.stackBytes = stackDepth();
+#endif
+    result.frameMicros = reader->getStats().maxParseMicros;
+    return result;
+}
+
+
+static bool overBudget(const FuzzResult &result) {
+#ifdef FUZZ_SANITIZED
+    return false;
+#endif
+    return (result.byteNs > FUZZ_BYTE_BUDGET_US * 1000 || result.frameMicros > FUZZ_FRAME_BUDGET_US ||
+        result.stackBytes > FUZZ_STACK_BUDGET);
+}
+
+
+// a single run might have been preempted, so new maxima are confirmed
+static bool newWorst(const FuzzResult &result) {
+    return (result.byteNs > worst.byteNs || result.frameMicros > worst.frameMicros);
+}
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static SMLReader *reader = NULL;
+    FuzzResult result, retry;
+
+    if (reader == NULL) {
+        loadOBISRegistry();
+        reader = new SMLReader(0, new BufferSource(NULL, 0));
+    }
+
+    result = runInput(reader, data, size);
+    for (uint8_t i = 0; i < FUZZ_RETRIES && (overBudget(result) || newWorst(result)); i++) {
+        retry = runInput(reader, data, size);  // process might have been preempted
+        result.byteNs = (retry.byteNs < result.byteNs) ? retry.byteNs : result.byteNs;
+        result.frameMicros = (retry.frameMicros < result.frameMicros) ? retry.frameMicros : result.frameMicros;
+        result.stackBytes = retry.stackBytes;
+    }
+    if (overBudget(result)) {
+        fprintf(stderr, "Budget exceeded: %u ns/byte, %u us/message, %u bytes of stack\n",
+            result.byteNs, result.frameMicros, result.stackBytes);
+        abort();
+    }
+
+    worst.byteNs = (result.byteNs > worst.byteNs) ? result.byteNs : worst.byteNs;
+    worst.frameMicros = (result.frameMicros > worst.frameMicros) ? result.frameMicros : worst.frameMicros;
+    worst.stackBytes = (result.stackBytes > worst.stackBytes) ? result.stackBytes : worst.stackBytes;
+    totalInputs++;
+    totalBytes += size;
+    return 0;
+}
+
+
+#ifndef SML_LIBFUZZER
+static const uint8_t meters = sizeof(SML_TESTDATA_SIZE) / sizeof(SML_TESTDATA_SIZE[0]);
+
+
+// consecutive copies of a message from testdata.h
+static std::vector<uint8_t> seedInput(uint8_t meter, uint8_t frames) {
+    std::vector<uint8_t> input;
+
+    for (uint8_t i = 0; i < frames; i++)
+        input.insert(input.end(), SML_TESTDATA[meter], SML_TESTDATA[meter] + SML_TESTDATA_SIZE[meter]);
+    return input;
+}
+
+
+// flip, replace, insert or remove bytes of the last message, truncate it
+// or prepend noise; checksum fixed most of the time to get past the CRC
+static void mutateInput(std::vector<uint8_t> &input, uint16_t frameSize) {
+    size_t frameStart = input.size() - frameSize, pos, noise;
+    uint8_t count = 1 + rand() % 4;
+    uint16_t crc;
+
+    for (uint8_t i = 0; i < count && input.size() > frameStart + 16; i++) {
+        pos = frameStart + 8 + rand() % (input.size() - frameStart - 16);
+        switch (rand() % 6) {
+            case 0: input[pos] ^= 1 << (rand() % 8); break;
+            case 1: input[pos] = rand() & 0xFF; break;
+            case 2: input.insert(input.begin() + pos, rand() & 0xFF); break;
+            case 3: input.erase(input.begin() + pos); break;
+            case 4: input.resize(pos); break;
+            case 5:
+                noise = rand() % 64;
+                input.insert(input.begin() + frameStart, noise, rand() & 0xFF);
+                frameStart += noise;
+                break;
+        }
+    }
+    if (rand() % 8 && input.size() > frameStart + 16) {
+        crc = smlMessageCRC(&input[frameStart + 4], input.size() - frameStart - 6);
+        input[input.size() - 2] = crc & 0xFF;
+        input[input.size() - 1] = crc >> 8;
+    }
+}
+
+
+// write every message from testdata.h as seed for libFuzzer
+static int writeCorpus(const char *dir) {
+    std::vector<uint8_t> input;
+    char path[256];
+    FILE *f;
+
+    for (uint8_t m = 0; m < meters; m++) {
+        input = seedInput(m, FUZZ_SEED_FRAMES);
+        snprintf(path, sizeof(path), "%s/%s", dir, SML_TESTDATA_NAME[m]);
+        if ((f = fopen(path, "wb")) == NULL) {
+            perror(path);
+            return 1;
+        }
+        fwrite(input.data(), 1, input.size(), f);
+        fclose(f);
+    }
+    printf("Wrote %d seeds to %s\n", meters, dir);
+    return 0;
+}
+
+
+// replay given inputs, e.g. crashes found by libFuzzer
+static int replayFiles(int count, char **paths) {
+    std::vector<uint8_t> input(FUZZ_MAX_INPUT);
+    size_t size;
+    FILE *f;
+
+    for (int i = 0; i < count; i++) {
+        if ((f = fopen(paths[i], "rb")) == NULL) {
+            perror(paths[i]);
+            return 1;
+        }
+        size = fread(input.data(), 1, input.size(), f);
+        fclose(f);
+        LLVMFuzzerTestOneInput(input.data(), size);
+        printf("%s: %zu bytes\n", paths[i], size);
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    uint32_t iterations = FUZZ_ITERATIONS, seed = 1;
+    std::vector<uint8_t> input;
+    uint8_t m;
+
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+        return writeCorpus(argv[2]);
+    if (argc > 1 && atol(argv[1]) <= 0)
+        return replayFiles(argc - 1, argv + 1);
+    if (argc > 1)
+        iterations = atol(argv[1]);
+    if (argc > 2)
+        seed = atol(argv[2]);
+
+    printf("Fuzzing SMLReader with %u mutated messages (seed %u)\n", iterations, seed);
+    srand(seed);
+    for (uint32_t i = 0; i < iterations; i++) {
+        m = rand() % meters;
+        input = seedInput(m, 1 + rand() % FUZZ_SEED_FRAMES);
+        mutateInput(input, SML_TESTDATA_SIZE[m]);
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+
+    printf("%llu inputs, %llu bytes\n", (unsigned long long)totalInputs, (unsigned long long)totalBytes);
+    printf("max. %u ns/byte (budget %u), %u us/message (budget %u)",
+        worst.byteNs, FUZZ_BYTE_BUDGET_US * 1000, worst.frameMicros, FUZZ_FRAME_BUDGET_US);
+#ifdef FUZZ_SANITIZED
+    printf(", stack not measured (sanitizer)\n");
+#else
+    printf(", %u bytes of stack (budget %u)\n", worst.stackBytes, FUZZ_STACK_BUDGET);
+#endif
+    return 0;
+}
+#endif
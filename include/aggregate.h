@@ -0,0 +1,85 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _AGGREGATE_H
+#define _AGGREGATE_H
+
+#include <Arduino.h>
+#include "smlparser.h"
+#include "config.h"
+
+#ifdef SML_AGGREGATE_WINDOWS
+
+// lengths of aggregation windows in seconds
+static constexpr uint32_t SMLAggregateWindows[] = SML_AGGREGATE_WINDOWS;
+#define SML_AGGREGATE_COUNT (sizeof(SMLAggregateWindows) / sizeof(SMLAggregateWindows[0]))
+#define SML_AGGREGATE_MAX_SECS 86400
+
+static constexpr bool validAggregateWindows(uint8_t i = 0) {
+    return (i >= SML_AGGREGATE_COUNT) || (SMLAggregateWindows[i] > 0 &&
+        SMLAggregateWindows[i] <= SML_AGGREGATE_MAX_SECS && validAggregateWindows(i + 1));
+}
+static_assert(validAggregateWindows(), "SML_AGGREGATE_WINDOWS must be between 1 and 86400 seconds");
+
+// messages with older timestamps are ignored (system time not set yet)
+#define SML_AGGREGATE_VALID_TIME 1577836800  // 2020-01-01
+
+// aggregate of a value slot in a window, fixed-point with the scaler of
+// its first value; power (W, VA, var): min, max and sum of all values,
+// energy (Wh, VAh, varh): value at start of window (last value of the
+// previous window if adjacent) and last value
+typedef struct {
+    int64_t min;  // or value at start (energy)
+    int64_t max;  // or last value (energy)
+    int64_t sum;
+    uint32_t count;  // values in window
+    int8_t scaler;
+} SMLAggregateValue;
+
+// window aligned to multiples of its length (unix time)
+typedef struct {
+    time_t start;
+    uint32_t secs;
+    uint32_t frames;  // messages in window
+    time_t first;  // timestamps of first and last message
+    time_t last;
+    uint32_t present;  // bitmask of value slots aggregated in window
+    uint32_t carried;  // energy slots with start value from previous window
+    SMLAggregateValue values[OBIS_REGISTRY_SLOTS];
+} SMLAggregate;
+
+// open and last closed window of every length, only written by the
+// reader task with the snapshot of its readings
+typedef struct {
+    SMLAggregate open[SML_AGGREGATE_COUNT];
+    SMLAggregate closed[SML_AGGREGATE_COUNT];
+    uint32_t closedCount[SML_AGGREGATE_COUNT];  // windows closed so far
+} SMLAggregates;
+
+void resetAggregates(SMLAggregates *agg);
+void aggregateReadings(SMLAggregates *agg, const SMLDeviceReadings &data);
+bool expiredAggregates(const SMLAggregates *agg, time_t now);
+void closeAggregates(SMLAggregates *agg, time_t now);
+bool aggregatePower(uint8_t slot);
+bool aggregateEnergy(uint8_t slot);
+double aggregateValue(int64_t val, int8_t scaler, uint8_t slot);
+
+#endif
+#endif
@@ -0,0 +1,104 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _BYTESOURCE_H
+#define _BYTESOURCE_H
+
+#include <Arduino.h>
+#include <memory>
+#ifndef SML_NATIVE
+#include <SoftwareSerial.h>
+#endif
+
+// baud rate equivalent for replaying messages from testdata.h
+#define SML_TESTDATA_BAUD 9600
+
+// pause between replayed messages from testdata.h
+#define SML_TESTDATA_INTERVAL_MS 5000
+
+// interface for all sources of SML data fed into an SMLReader
+class ByteSource {
+    public:
+        virtual ~ByteSource() {}
+        virtual int available() = 0;
+        virtual int read() = 0;  // -1 if no data available
+        // up to 'size' bytes without waiting, returns number of bytes read
+        virtual int read(uint8_t *buf, int size) {
+            int len = 0, c;
+            while (len < size && (c = this->read()) >= 0)
+                buf[len++] = c;
+            return len;
+        }
+        // optional notification on incoming data, might be called from ISR
+        virtual void onReceive(void (*handler)(void*), void *arg) {}
+};
+
+#ifndef SML_NATIVE
+// IR reading head connected to given pin
+class SoftwareSerialSource : public ByteSource {
+    public:
+        SoftwareSerialSource(const uint8_t pin, const uint16_t bufSize);
+        int available();
+        int read();
+        int read(uint8_t *buf, int size);
+        void onReceive(void (*handler)(void*), void *arg);
+    private:
+        std::unique_ptr<SoftwareSerial> ss;
+};
+#endif
+
+#ifdef DEBUG_TESTDATA
+// replays all messages from testdata.h starting with the given one (or
+// only this one if 'repeat' is set) at a transfer rate equivalent to
+// 'baud' (as fast as possible if 0)
+class ReplaySource : public ByteSource {
+    public:
+        ReplaySource(const uint32_t baud, const uint8_t first, const bool repeat = false);
+        int available();
+        int read();
+        int read(uint8_t *buf, int size);
+    private:
+        uint32_t baud;
+        uint8_t frame;
+        bool repeat;
+        uint16_t pos = 0;
+        uint32_t frameStart;  // micros() when first byte was 'sent'
+};
+#endif
+
+#ifdef SML_NATIVE
+// regular file, named pipe or pty on the host
+class FileSource : public ByteSource {
+    public:
+        FileSource(const char *path);
+        ~FileSource();
+        bool isOpen();
+        int available();
+        int read();
+        int read(uint8_t *buf, int size);
+    private:
+        int fd;
+        uint8_t buf[256];
+        uint16_t len = 0;
+        uint16_t pos = 0;
+};
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <Arduino.h>
+#include "smlparser.h"
+#include "config.h"
+
+#ifdef SML_CAPTURE_BYTES
+
+#define SML_CAPTURE_MAGIC 0xC5
+
+// header of a captured message followed by 'size' raw bytes starting
+// with the escape sequence; a capture is a sequence of these records,
+// oldest first (little endian)
+typedef struct __attribute__((packed)) {
+    uint8_t magic;  // SML_CAPTURE_MAGIC
+    uint8_t state;  // sml_states_t, e.g. SML_CHECKSUM_ERROR
+    uint16_t msgSize;  // bytes received
+    uint16_t size;  // bytes captured (less if raw copy was truncated)
+    uint32_t timestamp;  // unix time of arrival
+    uint32_t millis;  // uptime at arrival
+} SMLCaptureHeader;
+
+// ring of most recent messages of a reading head, only written by its
+// reader task; older messages are overwritten by newer ones
+typedef struct {
+    uint8_t buf[SML_CAPTURE_BYTES];
+    uint32_t head;  // bytes written in total
+    uint32_t tail;  // start of oldest record
+} SMLCaptureRing;
+
+void resetCapture(SMLCaptureRing *ring);
+void captureMessage(SMLCaptureRing *ring, const SMLDeviceReadings &data, const char *raw, uint16_t size);
+uint16_t copyCapture(const SMLCaptureRing *ring, uint8_t *buf);
+
+#endif
+#endif
@@ -23,15 +23,57 @@
 
 // Specify one or more pins (max. 6) connected to RX pin of IR reading 
 // head The number of reading heads can be increased to 8 or even more
-// if SML_MSG_BUFFER is reduced to about 256 bytes (depends on smart 
+// if SML_RX_BUFFER and SML_FRAME_POOL_SIZE are reduced (depends on smart
 // meter message size) or if TLS for MQTT is disabled
 #define SML_READER_PINS { 4, 13, 14, 16, 17, 21 }
 
-// Buffer size for SML messages received with IR sensor; might need to be
-// increased to about 512 bytes or even more if a smart meter sends larger 
-// messages (look for "buffer exceeded message" in serial output). For 
-// larger buffer size you'll need to reduce number of IR heads (see above)
-#define SML_MSG_BUFFER 400
+// Service all IR reading heads from a single reader task (and a single
+// printer task) instead of two tasks per pin; saves about 5KB of RAM
+// per reading head and allows for more than 6 reading heads
+//#define SML_READER_SCHEDULER
+
+// Serial receive buffer per IR reading head; messages are parsed while
+// they arrive, so it only has to cover the time until the reader task
+// is scheduled (at 9600 baud about 100 bytes per 100ms)
+#define SML_RX_BUFFER 256
+
+// Shared pool for raw copies of SML messages (DEBUG_SML, capture ring or
+// frame template below); every reading head borrows two buffers sized to
+// the messages of its smart meter, e.g. 2x 512 bytes for an EasyMeter Q3A
+// or 2x 320 bytes for a smaller meter.
+// Raw copies are truncated or missing if the pool is exhausted (look for
+// "frame pool exhausted" in serial output)
+#define SML_FRAME_POOL_SIZE 6144
+
+// Keep the most recent raw SML messages of every IR reading head (also
+// those with checksum errors) in a ring of given size in RAM (power of 2)
+// which can be downloaded via MQTT for post-mortem analysis (see README);
+// needs the given number of bytes of RAM per reading head plus one more
+// for the download, e.g. 14KB for six reading heads with 2048 bytes
+//#define SML_CAPTURE_BYTES 2048
+
+// Learn the layout of the messages of every smart meter from a few
+// consecutive messages and read further messages by comparing them with
+// the last one and taking values from their known offsets instead of
+// running the SML state machine (falls back to it on any difference),
+// keeps raw copies of messages in the frame pool (enabled for the native
+// and fuzz environments on the host)
+//#define SML_FRAME_TEMPLATE
+
+// Aggregate the readings of every IR reading head over windows of the
+// given lengths in seconds (aligned to the clock, e.g. quarter hours):
+// min/max/mean of power values (W, VA, var) and change of energy values
+// (Wh, VAh, varh), published on <base>/<sysid>/<pin>/aggregate when a
+// window ends (also if the meter stays silent); needs about 1.1KB of RAM
+// per window and reading head, e.g. 13KB for two windows and six heads
+//#define SML_AGGREGATE_WINDOWS { 60, 900 }
+
+// Values published for each smart meter are read at boot from the given
+// JSON file in LittleFS (upload with "pio run -t uploadfs", see data/),
+// the built-in registry is used if the file is missing. Every value
+// needs about 9 bytes per reading head and 56 bytes for its definition
+#define OBIS_REGISTRY_FILE "/obis.json"
+#define OBIS_REGISTRY_SLOTS 16
 
 // schedule serial output of current SML readings every given number of seconds
 #define SML_PRINT_INTERVAL_SECS 5
@@ -44,6 +86,29 @@
 #define MQTT_BROKER_PORT 1883
 #define MQTT_BASE_TOPIC "smlreader"
 #define MQTT_INTERVAL_SECS 20
+// Publish readings of all reading heads combined in one message on
+// <base>/<sysid>/readings instead of one message per pin; messages are
+// split if they would exceed the given size (JSON not with DEBUG_SML)
+//#define MQTT_BATCH_PUBLISH
+#define MQTT_BATCH_MAX_BYTES 1536
+// Check readings every MQTT_CHANGE_CHECK_MS and only publish values which
+// moved beyond their deadband (see data/obis.json), all values are still
+// published at least every MQTT_MAX_SILENCE_SECS
+//#define MQTT_ON_CHANGE
+#define MQTT_CHANGE_CHECK_MS 1000
+#define MQTT_MAX_SILENCE_SECS 300
+// Readings which cannot be published during a WiFi or broker outage
+// are queued in LittleFS (about 200 bytes each, oldest readings are
+// dropped if full) and published at the given rate after reconnecting
+#define MQTT_SPOOL_RECORDS 1024
+#define MQTT_SPOOL_DRAIN_RATE 5
+// Publish counters of every reading head (frames, errors, data rate,
+// frame sizes, parse time) on <base>/<sysid>/<pin>/metrics and of the
+// MQTT publisher on <base>/<sysid>/metrics every given number of seconds
+#define MQTT_METRICS_SECS 300
+// Publish readings as MessagePack with numeric keys and fixed-point
+// values (see mqtt.h) instead of JSON on the same topics
+//#define MQTT_PAYLOAD_MSGPACK
 //#define MQTT_USERNAME "admin"
 //#define MQTT_PASSWORD "xxxxxx"
 //#define MQTT_TLS
@@ -54,8 +119,18 @@
 // onboard LED on LolinD32 (flashes on MQTT messages)
 #define LED_PIN 5
 
+// Sample stack headroom of all tasks and heap usage every given number of
+// seconds; published on <base>/<sysid>/profile and logged (all tasks with
+// LOG_DEBUG). CPU share per task is only added if FreeRTOS is built with
+// CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS, which the stock arduino-esp32
+// core doesn't set (needs Arduino as ESP-IDF component)
+#define PROFILER_SECS 60
+
+// Log messages up to the given level (LOG_ERROR, LOG_WARN, LOG_INFO or
+// LOG_DEBUG, see log.h) on the serial console
+#define LOG_LEVEL LOG_INFO
+
 #define DEBUG_SML
 //#define DEBUG_TESTDATA
-//#define DEBUG_MEMORY
 
 #endif
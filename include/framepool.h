@@ -0,0 +1,37 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _FRAMEPOOL_H
+#define _FRAMEPOOL_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// buffers for SML messages are handed out from a shared arena in
+// blocks of given size, so each reading head only holds as much
+// memory as the messages of its smart meter actually need
+#define SML_FRAME_BLOCK_SIZE 32
+#define SML_FRAME_BLOCKS (SML_FRAME_POOL_SIZE / SML_FRAME_BLOCK_SIZE)
+
+char* borrowFrameBuffer(uint16_t *size);
+void returnFrameBuffer(char *buf, uint16_t size);
+uint16_t framePoolFree();
+
+#endif
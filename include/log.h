@@ -0,0 +1,70 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+
+#define LOG_ERROR 1
+#define LOG_WARN 2
+#define LOG_INFO 3
+#define LOG_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+// log messages waiting for output (power of 2) and max. length of a message
+#define LOG_RING_SIZE 32
+#define LOG_LINE_SIZE 112
+#define LOG_DRAIN_MS 20
+
+// warnings and errors of the same call site are printed at most every
+// LOG_RATE_LIMIT_MS, the number of suppressed messages is appended
+#define LOG_RATE_LIMIT_MS 1000
+
+typedef struct {
+    std::atomic<uint32_t> lastMillis{0};
+    std::atomic<uint32_t> suppressed{0};
+} LogSite;
+
+void startLog();
+void logWrite(uint8_t level, LogSite *site, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+uint32_t droppedLogMessages();
+
+// messages are formatted by the caller and printed with a leading
+// timestamp by a low-priority task, callers never block on Serial
+#define LOG_AT(level, site, fmt, ...) \
+    do { if ((level) <= LOG_LEVEL) logWrite((level), (site), fmt, ##__VA_ARGS__); } while (0)
+#define LOG_LIMITED(level, fmt, ...) \
+    do { static LogSite _site; LOG_AT(level, &_site, fmt, ##__VA_ARGS__); } while (0)
+
+#define logError(fmt, ...) LOG_LIMITED(LOG_ERROR, fmt, ##__VA_ARGS__)
+#define logWarn(fmt, ...) LOG_LIMITED(LOG_WARN, fmt, ##__VA_ARGS__)
+// rate limited by the given site, e.g. one per call site and reading head
+#define logWarnAt(site, fmt, ...) LOG_AT(LOG_WARN, site, fmt, ##__VA_ARGS__)
+#define logInfo(fmt, ...) LOG_AT(LOG_INFO, NULL, fmt, ##__VA_ARGS__)
+#define logDebug(fmt, ...) LOG_AT(LOG_DEBUG, NULL, fmt, ##__VA_ARGS__)
+
+#endif
@@ -33,6 +33,67 @@
 #define MQTT_KEEPALIVE_SECS MQTT_INTERVAL_SECS*1.5
 #define MQTT_CLIENT_ID "smlreader_%d"
 #define MQTT_CONNECT_WAIT_SECS 10
+#define MQTT_PUBLISH_WAIT_MS 1000  // publisher task also wakes up on new messages
+
+// readings of all pins are combined in as few messages as possible,
+// raw SML messages (DEBUG_SML) as JSON are always published per pin
+#if defined(MQTT_BATCH_PUBLISH) && (!defined(DEBUG_SML) || defined(MQTT_PAYLOAD_MSGPACK))
+#define MQTT_BATCH
+#endif
+
+// max. size of MQTT payload and JSON document for readings of a pin
+#if defined(MQTT_BATCH)
+#define MQTT_PAYLOAD_SIZE MQTT_BATCH_MAX_BYTES
+#elif defined(DEBUG_SML)
+#define MQTT_PAYLOAD_SIZE 1280
+#else
+#define MQTT_PAYLOAD_SIZE 512
+#endif
+#ifdef DEBUG_SML
+#define MQTT_READINGS_JSON_SIZE 1024
+#else
+#define MQTT_READINGS_JSON_SIZE (JSON_OBJECT_SIZE(OBIS_REGISTRY_SLOTS + 9) + 32)
+#endif
+
+// JSON document for metrics of a reading head or the publisher
+#define MQTT_METRICS_JSON_SIZE (JSON_OBJECT_SIZE(14) + JSON_ARRAY_SIZE(SML_FRAME_SIZE_BUCKETS) + 32)
+
+// JSON document for a task profile (split into several messages if needed)
+#define MQTT_PROFILE_JSON_SIZE (JSON_OBJECT_SIZE(8) + JSON_OBJECT_SIZE(PROFILER_MAX_TASKS) + \
+    PROFILER_MAX_TASKS * (JSON_ARRAY_SIZE(2) + PROFILER_TASK_NAME))
+
+// JSON document for an aggregation window (split into several messages
+// if needed), power values as [min, mean, max]
+#define MQTT_AGGREGATE_JSON_SIZE (JSON_OBJECT_SIZE(OBIS_REGISTRY_SLOTS + 7) + \
+    OBIS_REGISTRY_SLOTS * JSON_ARRAY_SIZE(3))
+
+// requested capture rings (SML_CAPTURE_BYTES)
+#define MQTT_CAPTURE_NONE -1
+#define MQTT_CAPTURE_ALL -2
+
+// max. number of reading heads tracked for publishing on change
+#define MQTT_ON_CHANGE_PINS 16
+
+// keys of MessagePack readings (MQTT_PAYLOAD_MSGPACK); values of the OBIS
+// registry slots (in order of the registry file) are published with key
+// MQTT_KEY_VALUES + slot as [value, scaler] (value * 10^scaler, e.g. Wh)
+typedef enum {
+    MQTT_KEY_PIN = 0,
+    MQTT_KEY_TIMESTAMP = 1,
+    MQTT_KEY_VERSION = 2,
+    MQTT_KEY_ERROR = 3,
+    MQTT_KEY_MANUFACTURER = 4,
+    MQTT_KEY_SERVERID = 5,  // binary
+    MQTT_KEY_SML = 6,  // raw SML message with DEBUG_SML (binary)
+    MQTT_KEY_METERS = 7,  // array of readings (MQTT_BATCH_PUBLISH)
+    MQTT_KEY_CHANGE = 8,  // only changed values (MQTT_ON_CHANGE)
+    MQTT_KEY_VALUES = 16
+} mqtt_key_t;
+
+typedef enum {
+    MQTT_ERROR_CHECKSUM = 1,
+    MQTT_ERROR_BUFFER = 2
+} mqtt_error_t;
 
 #if defined(MQTT_TLS) && MQTT_BROKER_PORT == 1883
 #undef MQTT_BROKER_PORT
@@ -40,6 +101,10 @@
 #endif
 
 void startMQTT();
-void publishData(const SMLDeviceReadings &data);
+void publishReadings();
+void drainSpool();
+#ifdef SML_AGGREGATE_WINDOWS
+void publishAggregates();
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _MQTTQUEUE_H
+#define _MQTTQUEUE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "mqtt.h"
+
+// number of encoded messages waiting for the publisher task (power of 2)
+#define MQTT_QUEUE_SLOTS 8
+
+typedef enum {
+    MQTT_MSG_STATE = 0,  // <base>/<sysid>/state
+    MQTT_MSG_READINGS = 1,  // <base>/<sysid>/<pin>/state
+    MQTT_MSG_BATCH = 2,  // <base>/<sysid>/readings
+    MQTT_MSG_METRICS = 3,  // <base>/<sysid>/metrics
+    MQTT_MSG_READER_METRICS = 4,  // <base>/<sysid>/<pin>/metrics
+    MQTT_MSG_PROFILE = 5,  // <base>/<sysid>/profile (pin is part of report)
+    MQTT_MSG_AGGREGATE = 6  // <base>/<sysid>/<pin>/aggregate
+} mqtt_msg_t;
+
+// encoded message, an older message is replaced by a newer one of the
+// same type and pin if it contains at least the same value slots
+typedef struct {
+    uint8_t type;
+    uint8_t pin;
+    bool retain;
+    uint32_t values;  // 0 if never replaced (e.g. queued readings)
+    uint16_t len;
+    uint32_t queuedMillis;  // for publish latency
+    char payload[MQTT_PAYLOAD_SIZE];
+} MQTTMessage;
+
+// single producer (loop) and single consumer (publisher task)
+MQTTMessage* mqttQueueReserve();
+void mqttQueuePush();
+MQTTMessage* mqttQueuePeek();
+void mqttQueuePop();
+void mqttQueueDrop();
+uint32_t mqttQueueDepth();
+uint32_t mqttQueueRejected();
+uint32_t mqttQueueDropped();
+uint32_t mqttQueueCoalesced();
+
+#endif
@@ -0,0 +1,45 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _MSGPACK_H
+#define _MSGPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// minimal MessagePack encoder writing into a fixed buffer, only the
+// types needed for readings (integer keys, fixed-point values, strings
+// and binary data); 'overflow' is set if the buffer is too small
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} msgpack_t;
+
+void mpInit(msgpack_t *mp, uint8_t *buf, size_t size);
+void mpMap(msgpack_t *mp, uint16_t entries);
+void mpArray(msgpack_t *mp, uint16_t entries);
+void mpUint(msgpack_t *mp, uint64_t val);
+void mpInt(msgpack_t *mp, int64_t val);
+void mpStr(msgpack_t *mp, const char *str, size_t len);
+void mpBin(msgpack_t *mp, const uint8_t *data, size_t len);
+
+#endif
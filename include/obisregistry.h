@@ -0,0 +1,56 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _OBISREGISTRY_H
+#define _OBISREGISTRY_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifndef OBIS_REGISTRY_SLOTS
+#define OBIS_REGISTRY_SLOTS 16
+#endif
+
+// max. number of OBIS codes mapped to value slots (several codes might
+// be mapped to the same slot, e.g. 1-0:36.7.0 and 1-0:21.7.0 for L1)
+#define OBIS_REGISTRY_CODES 32
+
+// value slot decoded from SML messages and published via MQTT
+typedef struct {
+    char name[28];  // key for MQTT messages
+    char label[28];  // for serial output
+    uint8_t unit;  // expected DLMS unit (sml_units_t), 0 for any
+    int8_t scale;  // published as multiple of 10^scale, e.g. 3 for kWh
+    uint8_t deadbandPct;  // min. change relative to last published value
+    float deadband;  // min. absolute change (in published unit)
+} OBISValueSlot;
+
+void loadOBISRegistry();
+void defaultOBISRegistry();
+bool addOBISRegistrySlot(const char *name, const char *label, uint8_t unit, int8_t scale,
+    float deadband = 0, uint8_t deadbandPct = 0);
+bool addOBISRegistryCode(const char *obis, uint8_t slot);
+int8_t obisRegistryLookup(uint64_t key);
+uint8_t obisRegistrySlots();
+const OBISValueSlot* obisRegistrySlot(uint8_t slot);
+uint8_t obisUnitCode(const char *unit);
+const char* obisUnitName(uint8_t unit);
+
+#endif
@@ -0,0 +1,62 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+
+#define PROFILER_MAX_TASKS 32
+#define PROFILER_TASK_NAME 16
+
+// CPU share per task needs the FreeRTOS run time statistics, which are not
+// enabled by the stock arduino-esp32 core (see README)
+#if defined(configGENERATE_RUN_TIME_STATS) && (configGENERATE_RUN_TIME_STATS == 1)
+#define PROFILER_CPU
+#endif
+
+typedef struct {
+    char name[PROFILER_TASK_NAME];
+    uint8_t priority;
+#ifdef PROFILER_CPU
+    uint16_t cpu;  // per mille of all cores since last sample
+#endif
+    uint32_t stackFree;  // min. free stack since task start (bytes)
+} TaskProfile;
+
+typedef struct {
+    uint32_t millis;  // time of sample
+#ifdef PROFILER_CPU
+    bool cpuValid;  // false for first sample
+#endif
+    uint8_t numTasks;
+    uint32_t freeHeap;
+    uint32_t minFreeHeap;  // since boot
+    uint32_t maxBlock;  // largest free block
+    uint8_t fragmentation;  // percent of free heap not in largest block
+    TaskProfile tasks[PROFILER_MAX_TASKS];
+} ProfileReport;
+
+void startProfiler();
+bool getProfile(ProfileReport *report);
+
+#endif
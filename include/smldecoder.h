@@ -0,0 +1,94 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _SMLDECODER_H
+#define _SMLDECODER_H
+
+#include <stdint.h>
+
+#define SML_MAX_LIST_SIZE 80
+#define SML_MAX_TREE_SIZE 10
+
+// states of the SML state machine, numbered like in the sml_parser
+// library it was derived from (published and captured as is)
+typedef enum {
+    SML_START,
+    SML_END,
+    SML_VERSION,
+    SML_NEXT,
+    SML_LISTSTART,
+    SML_LISTEND,
+    SML_LISTEXTENDED,
+    SML_DATA,
+    SML_HDATA,
+    SML_DATAEND,
+    SML_BLOCKSTART,
+    SML_BLOCKEND,
+    SML_CHECKSUM,
+    SML_CHECKSUM_ERROR,
+    SML_UNEXPECTED,
+    SML_FINAL,
+    SML_DATA_SIGNED_INT,
+    SML_DATA_UNSIGNED_INT,
+    SML_DATA_OCTET_STRING
+} sml_states_t;
+
+// DLMS unit codes of values found in smart meter messages
+typedef enum {
+    SML_DEGREE_CELSIUS = 9,
+    SML_CUBIC_METRE = 13,
+    SML_WATT = 27,
+    SML_VOLT_AMPERE = 28,
+    SML_VAR = 29,
+    SML_WATT_HOUR = 30,
+    SML_VOLT_AMPERE_HOUR = 31,
+    SML_VAR_HOUR = 32,
+    SML_AMPERE = 33,
+    SML_VOLT = 35,
+    SML_HERTZ = 44,
+    SML_COUNT = 255
+} sml_units_t;
+
+// Reentrant SML state machine, derived from the sml_parser library which
+// keeps its state in global variables and can thus only be used for a
+// single reading head. Every SMLReader owns its own context, so multiple
+// readers can parse messages concurrently.
+typedef struct {
+    sml_states_t state;
+    uint16_t len;  // remaining bytes in current state
+    uint8_t type;  // first type-length byte of data with more of them
+    uint8_t level;  // current nesting level of SML lists
+    uint8_t nodes[SML_MAX_TREE_SIZE+1];  // remaining nodes per level
+    uint16_t crc;
+    uint16_t crcMine;
+    uint16_t crcReceived;
+    uint8_t listBuffer[SML_MAX_LIST_SIZE];  // size, type and data of current list
+    uint8_t listPos;
+} sml_context_t;
+
+void smlInit(sml_context_t *ctx);
+sml_states_t smlState(sml_context_t *ctx, uint8_t currentByte);
+uint16_t smlMessageCRC(const uint8_t *buf, uint16_t len);
+bool smlOBISCheck(const sml_context_t *ctx, const uint8_t *obis);
+uint64_t smlOBISKey(const sml_context_t *ctx);
+bool smlOBISValue(const sml_context_t *ctx, sml_units_t unit, int64_t &val, int8_t &scaler);
+uint8_t smlOBISOctetString(const sml_context_t *ctx, uint8_t *buf, uint8_t maxSize);
+
+#endif
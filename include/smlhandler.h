@@ -23,14 +23,8 @@
 
 #include <Arduino.h>
 
-void Manufacturer(SMLDeviceReadings *data, const byte *obis);
-void Serialnumber(SMLDeviceReadings *data, const byte *obis);
-void EnergyFromGridTotal(SMLDeviceReadings *data, const byte *obis);
-void EnergyToGridTotal(SMLDeviceReadings *data, const byte *obis);
-void PowerFromGridTotal(SMLDeviceReadings *data, const byte *obis);
-void PowerToGridTotal(SMLDeviceReadings *data, const byte *obis);
-void PowerFromGridL1(SMLDeviceReadings *data, const byte *obis);
-void PowerFromGridL2(SMLDeviceReadings *data, const byte *obis);
-void PowerFromGridL3(SMLDeviceReadings *data, const byte *obis);
+void Manufacturer(SMLDeviceReadings *data, const sml_context_t *sml, const byte *obis);
+void Serialnumber(SMLDeviceReadings *data, const sml_context_t *sml, const byte *obis);
+bool OBISValue(SMLDeviceReadings *data, const sml_context_t *sml, uint8_t slot);
 
 #endif
\ No newline at end of file
@@ -22,33 +22,111 @@
 #define _SMLPARSER_H
 
 #include <Arduino.h>
-#include <sml.h>
+#include "smldecoder.h"
+#include "obisregistry.h"
+#include "log.h"
 #include "config.h"
 
+// max. size of an SML message, larger messages are dropped
+#define SML_MAX_MSG_SIZE 1024
+
+// raw copy of messages for debugging output, the capture ring or
+// comparison with the frame template
+#if defined(DEBUG_SML) || defined(SML_CAPTURE_BYTES) || defined(SML_FRAME_TEMPLATE)
+#define SML_RAW_COPY
+#endif
+
+// number of consecutive messages with the same layout (compared to their
+// predecessor) before further messages are read with the learned template
+#define SML_TEMPLATE_FRAMES 2
+
+// compact set of readings which is cheap to copy; values of all slots in
+// the OBIS registry are kept as received (fixed-point with decimal scaler)
+// and only turned into floating-point numbers for output
 typedef struct {
     uint8_t pin;
     unsigned char manufacturer[4]; // 3 byte manufacturer signature
-    char serialnumber[21]; // 10 bytes stored as hex string
-    double energyFromGridTotal;
-    double energyToGridTotal;
-    double powerFromGridTotal;
-    double powerToGridTotal;
-    double powerFromGridL1;
-    double powerFromGridL2;
-    double powerFromGridL3;
+    uint8_t serverId[10]; // serial number
+    uint8_t serverIdLen;
+    uint32_t present; // bitmask of value slots found in message
+    int8_t scaler[OBIS_REGISTRY_SLOTS]; // value * 10^scaler
+    int64_t value[OBIS_REGISTRY_SLOTS];
     time_t timestamp; // set to '0' to invalidate dataset
-    char fullMessage[SML_MSG_BUFFER];
     uint16_t msgSize;
-    sml_states_t state;
+    uint8_t state; // sml_states_t
 } SMLDeviceReadings;
 
+// position of a value and its scaler in a message (SML_FRAME_TEMPLATE)
+typedef struct {
+    uint16_t valueOffset;  // 0 if value slot is not part of message
+    uint16_t scalerOffset;  // 0 if message has no scaler for value
+    uint8_t valueSize;
+    uint8_t valueType;  // SML_DATA_SIGNED_INT or SML_DATA_UNSIGNED_INT
+} SMLTemplateValue;
+
+// layout of the messages of a smart meter learned from the differences
+// between consecutive messages with the same structure (parser states and
+// OBIS codes); a message is read with the template if all bytes which never
+// changed are the same as in the last message
+typedef struct {
+    uint16_t size;  // of message, 0 if no layout learned yet
+    uint32_t layout;  // hash of parser states and OBIS codes
+    uint8_t frames;  // consecutive messages matching layout
+    uint8_t variable[SML_MAX_MSG_SIZE / 8];  // bitmask of changing bytes
+    SMLTemplateValue values[OBIS_REGISTRY_SLOTS];
+} SMLFrameTemplate;
+
+// warnings of a reading head, rate limited per head and not per call
+// site, so a faulty head doesn't hide the warnings of the others
+typedef enum {
+    SML_LOG_CHECKSUM,
+    SML_LOG_OVERFLOW,
+    SML_LOG_UNEXPECTED,
+    SML_LOG_ABANDONED,
+    SML_LOG_FRAME_POOL,
+    SML_LOG_SITES
+} sml_log_sites_t;
+
+// parser state of a single reading head
+typedef struct {
+    sml_context_t sml;  // SML state machine with list buffer and crc
+    uint16_t frameCounter;  // position in current SML message
+    uint32_t unexpectedBytes;  // bytes outside of a valid message
+    bool resync;  // lost sync, skip to next start sequence (scanSMLStart())
+    uint8_t resyncMatch;  // bytes of start sequence found so far
+#ifdef SML_RAW_COPY
+    char *rawMessage; // raw copy of message for debugging (see framepool.h)
+    uint16_t rawCapacity; // larger messages are truncated
+#endif
+#ifdef SML_FRAME_TEMPLATE
+    const char *lastMessage;  // raw copy of last message if parsed (see SMLReader)
+    uint16_t lastSize;
+    uint16_t entryOffset;  // of current list entry in message
+    uint32_t layout;  // layout hash of current message
+    uint32_t lastLayout;
+    bool templateNext;  // try template with next message
+    bool templateFrame;  // current message is read with template
+    uint8_t templateStart;  // bytes of start sequence read with template
+    SMLTemplateValue learned[OBIS_REGISTRY_SLOTS];  // of current message
+    SMLFrameTemplate tmpl;
+#endif
+    LogSite logSites[SML_LOG_SITES];  // kept by resetSMLParser()
+} SMLParserContext;
+
 typedef struct {
     const byte OBIS[6];
-    void (*Handler)(SMLDeviceReadings *data, const byte *obis);
+    void (*Handler)(SMLDeviceReadings *data, const sml_context_t *sml, const byte *obis);
 } OBISHandler;
 
-bool readSMLByte(byte c, SMLDeviceReadings *data);
+bool readSMLByte(byte c, SMLParserContext *ctx, SMLDeviceReadings *data);
+uint16_t scanSMLStart(const byte *buf, uint16_t len, SMLParserContext *ctx, SMLDeviceReadings *data);
+bool abortSMLMessage(SMLParserContext *ctx);
+void resetSMLParser(SMLParserContext *ctx);
 void resetSMLReadings(SMLDeviceReadings *data);
-void printSMLReadings(const SMLDeviceReadings &data);
+bool smlHasValue(const SMLDeviceReadings &data, uint8_t slot);
+double smlValue(const SMLDeviceReadings &data, uint8_t slot);
+uint8_t smlValueDecimals(const SMLDeviceReadings &data, uint8_t slot);
+char* smlSerialnumber(const SMLDeviceReadings &data, char *buf);
+void printSMLReadings(const SMLDeviceReadings &data, const char *raw = NULL, uint16_t rawSize = 0);
 
 #endif
\ No newline at end of file
@@ -22,30 +22,132 @@
 #define _SMLREADER_H
 
 #include <Arduino.h>
-#include <SoftwareSerial.h>
 #include <list>
-#include "smlreader.h"
+#include <atomic>
+#include "bytesource.h"
 #include "smlparser.h"
+#include "framepool.h"
+#include "capture.h"
+#include "aggregate.h"
 
-#define SML_READER_INTERVAL_MS 5000
+// max. time reader task sleeps without rx notification before
+// checking the serial buffer anyway
+#define SML_READER_WAIT_MS 100
+
+// max. number of bytes parsed per reading head before the scheduler
+// moves on to the next one (SML_READER_SCHEDULER)
+#define SML_SCHEDULER_BUDGET 64
+
+// bytes taken from the serial buffer at once
+#define SML_READ_CHUNK 64
+
+// smart meters send every message in one go, so a pause of given length
+// (without data) ends an incomplete message which is then abandoned
+#define SML_FRAME_GAP_MS 250
+
+// frame size histogram (SML_FRAME_SIZE_STEP bytes per bucket, last
+// bucket holds all larger frames) and window for rx data rate
+#define SML_FRAME_SIZE_BUCKETS 6
+#define SML_FRAME_SIZE_STEP 128
+#define SML_RATE_WINDOW_MS 10000
+
+// raw message buffers (SML_RAW_COPY) are borrowed with the first message,
+// grow with the first larger message and shrink again if all messages
+// of a window of given size would have fit into smaller buffers
+#define SML_FRAME_RESIZE_FRAMES 16
+
+// counters of a reading head, only written by the reader task and read
+// field by field without locking (a snapshot might mix two updates)
+typedef struct {
+    uint8_t pin;
+    uint32_t frames;  // parsed without errors
+    uint32_t checksumErrors;
+    uint32_t overflows;  // buffer exceeded
+    uint32_t aborted;  // incomplete, abandoned after SML_FRAME_GAP_MS
+    uint32_t unexpectedBytes;
+    uint32_t bytes;  // received in total
+    uint32_t bytesPerSec;  // during last SML_RATE_WINDOW_MS
+    uint32_t frameSizes[SML_FRAME_SIZE_BUCKETS];
+    uint32_t parseMicros;  // spent parsing all completed frames
+    uint32_t maxParseMicros;  // single frame
+    uint32_t lastFrameMillis;  // last frame without errors
+} SMLReaderStats;
 
 class SMLReader {
     public:
         SMLReader();
         SMLReader(const uint8_t);
+        SMLReader(const uint8_t, ByteSource*);
+#ifdef SML_RAW_COPY
+        ~SMLReader();
+#endif
         bool begin(const uint8_t);
-        void read();
+        bool begin(const uint8_t, ByteSource*);
+        bool read(uint16_t budget = 0xFFFF);
         void startReader();
         void printReadings();
         void startPrinter();
+        static void startScheduler();
         SMLDeviceReadings getReadings();
+        SMLReaderStats getStats();
+#ifdef SML_RAW_COPY
+        uint16_t getRawMessage(char *buf, uint16_t size);
+#endif
+#ifdef SML_CAPTURE_BYTES
+        uint16_t getCapture(uint8_t *buf);
+#endif
+#ifdef SML_AGGREGATE_WINDOWS
+        uint32_t peekAggregate(uint8_t window, SMLAggregate *aggregate);
+        void commitAggregate(uint8_t window, uint32_t closed);
+#endif
     private:
         void readingTask();
         void printerTask();
+        void notifyReader();
+        void publishReadings();
+        void countFrame(uint32_t parseMicros);
+#ifdef SML_AGGREGATE_WINDOWS
+        void closeAggregates();
+#endif
+#ifdef SML_RAW_COPY
+        void adaptFrameBuffers(uint16_t msgSize);
+        bool resizeFrameBuffers(uint16_t size);
+        void releaseFrameBuffers();
+#endif
+        static void rxHandler(void*);
         static void printerTaskWrapper(void*);
         static void readingTaskWrapper(void*);
-        std::unique_ptr<SoftwareSerial> ss;
-        SMLDeviceReadings readings;
+        static void schedulerTask(void*);
+        static void schedulerPrinterTask(void*);
+        std::unique_ptr<ByteSource> source;
+        TaskHandle_t readerTask = NULL;  // own task or shared scheduler
+        volatile bool rxPending = false;
+        uint8_t pin;
+        SMLParserContext parser;
+        SMLDeviceReadings current;  // message currently being parsed
+        SMLDeviceReadings readings;  // snapshot of last completed message
+        std::atomic<uint32_t> seq{0};  // odd while snapshot is updated
+        SMLReaderStats stats;
+        uint32_t frameMicros = 0;  // spent on current frame so far
+        uint32_t rateBytes = 0;  // received in current rate window
+        uint32_t rateMillis = 0;  // start of rate window
+        uint32_t lastByteMillis = 0;  // for detection of gaps between messages
+#ifdef SML_RAW_COPY
+        char *rawBuffer = NULL;  // raw buffers of parser and snapshot in one piece
+        char *rawMessage = NULL;  // raw copy of last completed message
+        uint16_t rawSize = 0;
+        uint16_t rawCapacity = 0;  // of both raw buffers, parser and snapshot
+        uint16_t rawWindowMax = 0;  // largest message since last resize check
+        uint8_t rawWindowFrames = 0;
+        bool rawResizeFailed = false;
+#endif
+#ifdef SML_CAPTURE_BYTES
+        SMLCaptureRing capture;  // updated with snapshot
+#endif
+#ifdef SML_AGGREGATE_WINDOWS
+        SMLAggregates aggregates;  // updated with snapshot
+        uint32_t aggregatesTaken[SML_AGGREGATE_COUNT];  // closed windows published by consumer
+#endif
 };
 
 extern std::list<SMLReader *> *smlreaderList;
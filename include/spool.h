@@ -0,0 +1,61 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _SPOOL_H
+#define _SPOOL_H
+
+#include <Arduino.h>
+#include "smlparser.h"
+#include "config.h"
+
+#define MQTT_SPOOL_FILE "/spool.bin"
+#define MQTT_SPOOL_STATE_FILE "/spool.idx"
+
+// records kept in RAM before they are written to flash in one go,
+// pending records are written at least every MQTT_SPOOL_FLUSH_SECS
+#define MQTT_SPOOL_BATCH 8
+#define MQTT_SPOOL_FLUSH_SECS 120
+
+// drained records are persisted every given number of records, so at
+// most this number of readings is published twice after a reboot
+#define MQTT_SPOOL_STATE_INTERVAL 32
+
+// readings which could not be published, stored with their original
+// timestamp and encoded again when they are drained; values are kept by
+// registry slot, so records are only valid for the layout they were
+// written with (record size and name and unit of every slot)
+typedef struct {
+    uint16_t magic;
+    uint8_t partial;
+    uint32_t layout;  // hash of record size and OBIS registry  // only values which changed (MQTT_ON_CHANGE)
+    uint32_t seq;
+    uint32_t values;  // value slots to publish
+    SMLDeviceReadings data;
+} SpoolRecord;
+
+bool startSpool();
+void spoolReadings(const SMLDeviceReadings &data, uint32_t values, bool partial);
+void flushSpool(bool force);
+bool peekSpool(SpoolRecord *rec);
+void popSpool();
+uint32_t spooledReadings();
+uint32_t droppedReadings();
+
+#endif
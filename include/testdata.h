@@ -297,7 +297,7 @@ const uint8_t ISKRA_MT175_D1A52_V22_K0t[] = { // ISK, 06 49 53 4b 01 0e 1f 66 29
     0x63, 0x6A, 0x11, 0x00, 0x1B, 0x1B, 0x1B, 0x1B, 0x1A, 0x00, 0x69, 0x89 };
 
 // jagged array
-uint8_t* SML_TESTDATA[] = { 
+const uint8_t* const SML_TESTDATA[] = { 
         (uint8_t*)ISKRA_MT691_eHZ_MS2020,
         (uint8_t*)eBZ_DD3_DD3BZ06DTA_SMZ1, 
         (uint8_t*)HOLLEY_DTZ541_BDBA_with_PIN,
@@ -313,4 +313,18 @@ uint8_t* SML_TESTDATA[] = {
 
 const uint16_t SML_TESTDATA_SIZE[] = { 216, 232, 232, 244, 252, 252, 316, 324, 384, 460, 504 };
 
+const char* const SML_TESTDATA_NAME[] = {
+        "ISKRA_MT691_eHZ_MS2020",
+        "eBZ_DD3_DD3BZ06DTA_SMZ1",
+        "HOLLEY_DTZ541_BDBA_with_PIN",
+        "ITRON_OpenWay_3HZ_with_PIN",
+        "ISKRA_MT631_D2A51_V22_K0z_with_PIN",
+        "DZG_DVS_7420_2V_G2_mtr0",
+        "EMH_eHZ_HW8E2A5L0EK2P_2",
+        "DrNeuhaus_SMARTY_ix_130",
+        "ISKRA_MT175_eHZ",
+        "ISKRA_MT175_D1A52_V22_K0t",
+        "EasyMeter_Q3A_A1064V1009"
+    };
+
 #endif
\ No newline at end of file
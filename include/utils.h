@@ -22,23 +22,25 @@
 #define _UTILS_H
 
 #include <Arduino.h>
+#ifndef SML_NATIVE
 #include "esp_task_wdt.h"
 #include "esp_sleep.h"
 #include "esp_system.h"
 #include "esp_ota_ops.h"
+#endif
 
 #define WATCHDOG_TIMEOUT_SEC 90
 
 extern SemaphoreHandle_t SerialLock;
 
 void arr2str(const char *arr, int len, char *buf);
-void blinkLED(uint8_t repeat, uint16_t pause);
 char* removeSpaces(char *str);
+#ifndef SML_NATIVE
+void blinkLED(uint8_t repeat, uint16_t pause);
 void switchLED(bool state);
 void startWatchdog();
 void stopWatchdog();
 String systemID();
-void printFreeStackWatermark(const char *taskName);
-void debugTask(void* parameter);
+#endif
 
 #endif
\ No newline at end of file
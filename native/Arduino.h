@@ -0,0 +1,98 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// Minimal host replacement for the parts of the Arduino and FreeRTOS
+// API used by the SML parser. Only used for the 'native' environment
+// (see platformio.ini) to run the parser on Linux, never on the ESP32.
+
+#ifndef _NATIVE_ARDUINO_H
+#define _NATIVE_ARDUINO_H
+
+#ifndef SML_NATIVE
+#error "native/Arduino.h is only meant for the native environment"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+typedef uint8_t byte;
+
+#define F(str) (str)
+
+inline uint32_t micros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+inline uint32_t millis() {
+    return micros() / 1000;
+}
+
+inline char* dtostrf(double val, signed char width, unsigned char prec, char *buf) {
+    sprintf(buf, "%*.*f", width, prec, val);
+    return buf;
+}
+
+// serial output is discarded unless enabled, e.g. to keep the
+// parser's log messages out of the benchmark results
+inline bool& nativeSerialEnabled() {
+    static bool enabled = false;
+    return enabled;
+}
+
+class NativeSerial {
+    public:
+        int printf(const char *fmt, ...) {
+            va_list args;
+            int len = 0;
+            if (nativeSerialEnabled()) {
+                va_start(args, fmt);
+                len = vprintf(fmt, args);
+                va_end(args);
+            }
+            return len;
+        }
+        void print(const char *str) { this->printf("%s", str); }
+        void print(char c) { this->printf("%c", c); }
+        void print(uint32_t val) { this->printf("%u", val); }
+        void println(const char *str = "") { this->printf("%s\n", str); }
+};
+
+static NativeSerial Serial __attribute__((unused));
+
+// no preemptive tasks on the host, locks are no-ops
+typedef void* SemaphoreHandle_t;
+typedef void* TaskHandle_t;
+#define portMAX_DELAY 0xffffffffUL
+inline int xSemaphoreTake(SemaphoreHandle_t lock, uint32_t ticks) { return 1; }
+inline int xSemaphoreGive(SemaphoreHandle_t lock) { return 1; }
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+
+#endif
@@ -0,0 +1,197 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "aggregate.h"
+#include "obisregistry.h"
+
+#ifdef SML_AGGREGATE_WINDOWS
+
+
+// fixed-point value with another scaler (precision is lost if larger),
+// saturated since a corrupted scaler might be far off
+static int64_t rescale(int64_t val, int8_t from, int8_t to) {
+    int16_t diff = (int16_t)from - to;
+
+    if (diff > 18)
+        diff = 18;
+    for (; diff > 0; diff--) {
+        if (val > INT64_MAX / 10 || val < INT64_MIN / 10)
+            return (val > 0) ? INT64_MAX : INT64_MIN;
+        val *= 10;
+    }
+    if (diff < -18)
+        return 0;
+    for (; diff < 0; diff++)
+        val /= 10;
+    return val;
+}
+
+
+static int64_t saturatedAdd(int64_t a, int64_t b) {
+    if (b > 0 && a > INT64_MAX - b)
+        return INT64_MAX;
+    if (b < 0 && a < INT64_MIN - b)
+        return INT64_MIN;
+    return a + b;
+}
+
+
+static void clearWindow(SMLAggregate *window, uint32_t secs, time_t start) {
+    memset(window, 0, sizeof(SMLAggregate));
+    window->secs = secs;
+    window->start = start;
+}
+
+
+// move open window to closed one and start next window; energy values
+// continue with the last value of the closed window if it's adjacent,
+// so consecutive deltas add up to the total energy
+static void closeWindow(SMLAggregates *agg, uint8_t w, time_t start) {
+    SMLAggregate *open = &agg->open[w], *closed = &agg->closed[w];
+    uint8_t slot;
+
+    memcpy(closed, open, sizeof(SMLAggregate));
+    agg->closedCount[w]++;
+    clearWindow(open, closed->secs, start);
+    if (start != closed->start + closed->secs)
+        return;
+    for (slot = 0; slot < obisRegistrySlots(); slot++) {
+        if ((closed->present & (1UL << slot)) && aggregateEnergy(slot)) {
+            open->values[slot].min = closed->values[slot].max;
+            open->values[slot].scaler = closed->values[slot].scaler;
+            open->carried |= (1UL << slot);
+        }
+    }
+}
+
+
+void resetAggregates(SMLAggregates *agg) {
+    for (uint8_t w = 0; w < SML_AGGREGATE_COUNT; w++) {
+        clearWindow(&agg->open[w], SMLAggregateWindows[w], 0);
+        clearWindow(&agg->closed[w], SMLAggregateWindows[w], 0);
+        agg->closedCount[w] = 0;
+    }
+}
+
+
+// min/max/mean of power values, change of energy values
+bool aggregatePower(uint8_t slot) {
+    uint8_t unit = obisRegistrySlot(slot)->unit;
+    return (unit == SML_WATT || unit == SML_VOLT_AMPERE || unit == SML_VAR);
+}
+
+
+bool aggregateEnergy(uint8_t slot) {
+    uint8_t unit = obisRegistrySlot(slot)->unit;
+    return (unit == SML_WATT_HOUR || unit == SML_VOLT_AMPERE_HOUR || unit == SML_VAR_HOUR);
+}
+
+
+// add values of a parsed message to all windows, a window is closed by
+// the first message belonging to the next one or by closeAggregates()
+void aggregateReadings(SMLAggregates *agg, const SMLDeviceReadings &data) {
+    SMLAggregateValue *value;
+    SMLAggregate *window;
+    uint8_t w, slot;
+    int64_t val;
+    time_t start;
+
+    if (data.state != SML_FINAL || data.timestamp < SML_AGGREGATE_VALID_TIME)
+        return;
+
+    for (w = 0; w < SML_AGGREGATE_COUNT; w++) {
+        window = &agg->open[w];
+        start = data.timestamp - data.timestamp % window->secs;
+        if (window->frames > 0 && start != window->start)
+            closeWindow(agg, w, start);
+        else if (window->frames == 0 && start != window->start)  // carried values only to adjacent window
+            clearWindow(window, window->secs, start);
+        if (window->frames == 0) {
+            window->start = start;
+            window->first = data.timestamp;
+        }
+        window->last = data.timestamp;
+        window->frames++;
+
+        for (slot = 0; slot < obisRegistrySlots(); slot++) {
+            if (!smlHasValue(data, slot))
+                continue;
+            value = &window->values[slot];
+            if (value->count == 0 && !(window->carried & (1UL << slot)))
+                value->scaler = data.scaler[slot];
+            val = rescale(data.value[slot], data.scaler[slot], value->scaler);
+
+            if (aggregatePower(slot)) {
+                if (value->count == 0 || val < value->min)
+                    value->min = val;
+                if (value->count == 0 || val > value->max)
+                    value->max = val;
+                value->sum = saturatedAdd(value->sum, val);
+            } else if (aggregateEnergy(slot)) {
+                if (value->count == 0 && !(window->carried & (1UL << slot)))
+                    value->min = val;
+                value->max = val;
+            } else {
+                continue;
+            }
+            value->count++;
+            window->present |= (1UL << slot);
+        }
+    }
+}
+
+
+// true if a window with messages has ended at given time
+bool expiredAggregates(const SMLAggregates *agg, time_t now) {
+    for (uint8_t w = 0; w < SML_AGGREGATE_COUNT; w++) {
+        if (agg->open[w].frames > 0 && now >= agg->open[w].start + (time_t)agg->open[w].secs)
+            return true;
+    }
+    return false;
+}
+
+
+// close windows which have ended at given time even if no further
+// message arrives (meter silent or reading head unplugged)
+void closeAggregates(SMLAggregates *agg, time_t now) {
+    SMLAggregate *window;
+
+    if (now < SML_AGGREGATE_VALID_TIME)
+        return;
+    for (uint8_t w = 0; w < SML_AGGREGATE_COUNT; w++) {
+        window = &agg->open[w];
+        if (window->frames > 0 && now >= window->start + (time_t)window->secs)
+            closeWindow(agg, w, now - now % window->secs);
+    }
+}
+
+
+// fixed-point value as floating-point number in unit of value slot
+double aggregateValue(int64_t val, int8_t scaler, uint8_t slot) {
+    double fval = val;
+
+    for (scaler -= obisRegistrySlot(slot)->scale; scaler < 0; scaler++)
+        fval /= 10;
+    for (; scaler > 0; scaler--)
+        fval *= 10;
+    return fval;
+}
+
+#endif
@@ -0,0 +1,165 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "bytesource.h"
+#include "testdata.h"
+#include "config.h"
+#ifdef SML_NATIVE
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#endif
+
+
+#ifndef SML_NATIVE
+SoftwareSerialSource::SoftwareSerialSource(const uint8_t pin, const uint16_t bufSize) {
+    this->ss = std::unique_ptr<SoftwareSerial>(new SoftwareSerial());
+    this->ss->begin(9600, SWSERIAL_8N1, pin, -1, false, bufSize);
+    this->ss->enableTx(false);
+    this->ss->enableRx(true);
+}
+
+
+int SoftwareSerialSource::available() {
+    return this->ss->available();
+}
+
+
+int SoftwareSerialSource::read() {
+    return this->ss->read();
+}
+
+
+int SoftwareSerialSource::read(uint8_t *buf, int size) {
+    return this->ss->read(buf, size);
+}
+
+
+void SoftwareSerialSource::onReceive(void (*handler)(void*), void *arg) {
+    this->ss->onReceive([handler, arg](int available) { handler(arg); });
+}
+#endif
+
+
+#ifdef DEBUG_TESTDATA
+ReplaySource::ReplaySource(const uint32_t baud, const uint8_t first, const bool repeat) {
+    this->baud = baud;
+    this->repeat = repeat;
+    this->frame = first % (sizeof(SML_TESTDATA_SIZE) / sizeof(SML_TESTDATA_SIZE[0]));
+    this->frameStart = micros();
+}
+
+
+// number of bytes of current message 'received' so far
+int ReplaySource::available() {
+    uint16_t size = SML_TESTDATA_SIZE[this->frame];
+    uint64_t sent;
+
+    if (this->baud == 0)
+        return size - this->pos;
+    if ((int32_t)(micros() - this->frameStart) < 0)  // pause between messages
+        return 0;
+    sent = (uint64_t)(micros() - this->frameStart) * this->baud / 10 / 1000000;  // 8N1
+    return (sent < size ? sent : size) - this->pos;
+}
+
+
+int ReplaySource::read() {
+    uint8_t c;
+
+    return (this->read(&c, 1) == 1) ? c : -1;
+}
+
+
+int ReplaySource::read(uint8_t *buf, int size) {
+    int len = this->available();
+
+    if (len > size)
+        len = size;
+    if (len <= 0)
+        return 0;
+    memcpy(buf, &SML_TESTDATA[this->frame][this->pos], len);
+    this->pos += len;
+    if (this->pos >= SML_TESTDATA_SIZE[this->frame]) { // continue with next message
+        this->pos = 0;
+        if (!this->repeat)
+            this->frame = (this->frame + 1) % (sizeof(SML_TESTDATA_SIZE) / sizeof(SML_TESTDATA_SIZE[0]));
+        this->frameStart = micros() + (this->baud ? SML_TESTDATA_INTERVAL_MS * 1000 : 0);
+    }
+    return len;
+}
+#endif
+
+
+#ifdef SML_NATIVE
+FileSource::FileSource(const char *path) {
+    struct termios tty;
+
+    this->fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    if (this->fd >= 0 && isatty(this->fd) && tcgetattr(this->fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        cfsetispeed(&tty, B9600);
+        tcsetattr(this->fd, TCSANOW, &tty);
+    }
+}
+
+
+FileSource::~FileSource() {
+    if (this->fd >= 0)
+        close(this->fd);
+}
+
+
+bool FileSource::isOpen() {
+    return (this->fd >= 0);
+}
+
+
+int FileSource::available() {
+    ssize_t bytes;
+
+    if (this->pos >= this->len && this->fd >= 0) {
+        bytes = ::read(this->fd, this->buf, sizeof(this->buf));
+        this->len = (bytes > 0) ? bytes : 0;
+        this->pos = 0;
+    }
+    return this->len - this->pos;
+}
+
+
+int FileSource::read() {
+    if (this->available() <= 0)
+        return -1;
+    return this->buf[this->pos++];
+}
+
+
+int FileSource::read(uint8_t *buf, int size) {
+    int len = this->available();
+
+    if (len > size)
+        len = size;
+    if (len <= 0)
+        return 0;
+    memcpy(buf, this->buf + this->pos, len);
+    this->pos += len;
+    return len;
+}
+#endif
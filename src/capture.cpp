@@ -0,0 +1,99 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "capture.h"
+
+#ifdef SML_CAPTURE_BYTES
+
+#if (SML_CAPTURE_BYTES & (SML_CAPTURE_BYTES - 1)) != 0
+#error "SML_CAPTURE_BYTES must be a power of 2"
+#endif
+
+
+static void ringWrite(SMLCaptureRing *ring, uint32_t pos, const void *src, uint16_t len) {
+    uint16_t offset = pos & (SML_CAPTURE_BYTES - 1);
+    uint16_t first = (len < SML_CAPTURE_BYTES - offset) ? len : SML_CAPTURE_BYTES - offset;
+
+    memcpy(ring->buf + offset, src, first);
+    memcpy(ring->buf, (const uint8_t*)src + first, len - first);
+}
+
+
+static void ringRead(const SMLCaptureRing *ring, uint32_t pos, void *dst, uint16_t len) {
+    uint16_t offset = pos & (SML_CAPTURE_BYTES - 1);
+    uint16_t first = (len < SML_CAPTURE_BYTES - offset) ? len : SML_CAPTURE_BYTES - offset;
+
+    memcpy(dst, ring->buf + offset, first);
+    memcpy((uint8_t*)dst + first, ring->buf, len - first);
+}
+
+
+void resetCapture(SMLCaptureRing *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+
+// append raw copy of a completed message (parsed or not), drops the
+// oldest messages if the ring is full; the raw copy starts with the
+// third byte of the start sequence, so the first two are added again
+void captureMessage(SMLCaptureRing *ring, const SMLDeviceReadings &data, const char *raw, uint16_t size) {
+    static const uint8_t escape[2] = { 0x1B, 0x1B };
+    SMLCaptureHeader header;
+    uint32_t len;
+
+    if (raw == NULL)
+        size = 0;
+    if (size > SML_CAPTURE_BYTES - sizeof(header) - sizeof(escape))
+        size = SML_CAPTURE_BYTES - sizeof(header) - sizeof(escape);
+    len = sizeof(header) + (size > 0 ? sizeof(escape) + size : 0);
+
+    while (ring->head - ring->tail + len > SML_CAPTURE_BYTES) {
+        ringRead(ring, ring->tail, &header, sizeof(header));
+        ring->tail += sizeof(header) + header.size;
+    }
+
+    header.magic = SML_CAPTURE_MAGIC;
+    header.state = data.state;
+    header.msgSize = (data.msgSize > 0) ? data.msgSize + sizeof(escape) : 0;
+    header.size = len - sizeof(header);
+    header.timestamp = data.timestamp;
+    header.millis = millis();
+    ringWrite(ring, ring->head, &header, sizeof(header));
+    if (size > 0) {
+        ringWrite(ring, ring->head + sizeof(header), escape, sizeof(escape));
+        ringWrite(ring, ring->head + sizeof(header) + sizeof(escape), raw, size);
+    }
+    ring->head += len;
+}
+
+
+// copy of all records in ring (oldest first) into given buffer of
+// SML_CAPTURE_BYTES, returns number of bytes copied
+uint16_t copyCapture(const SMLCaptureRing *ring, uint8_t *buf) {
+    uint32_t len = ring->head - ring->tail;
+
+    if (len > SML_CAPTURE_BYTES)  // torn read, retried by caller
+        len = 0;
+    ringRead(ring, ring->tail, buf, len);
+    return len;
+}
+
+#endif
@@ -0,0 +1,84 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "framepool.h"
+
+static char pool[SML_FRAME_BLOCKS * SML_FRAME_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint8_t used[SML_FRAME_BLOCKS];  // blocks taken by a buffer
+static uint16_t freeBlocks = SML_FRAME_BLOCKS;
+
+// held only while scanning the block map, borrowed and returned by
+// reader tasks on both cores
+static portMUX_TYPE poolLock = portMUX_INITIALIZER_UNLOCKED;
+
+
+// buffer for at least the given number of bytes (first fit), its size
+// is rounded up to full blocks; returns NULL if the pool is exhausted
+char* borrowFrameBuffer(uint16_t *size) {
+    uint16_t blocks = (*size + SML_FRAME_BLOCK_SIZE - 1) / SML_FRAME_BLOCK_SIZE;
+    uint16_t start = 0, run = 0, i;
+    char *buf = NULL;
+
+    if (blocks == 0 || blocks > SML_FRAME_BLOCKS)
+        return NULL;
+
+    portENTER_CRITICAL(&poolLock);
+    for (i = 0; i < SML_FRAME_BLOCKS && buf == NULL; i++) {
+        if (used[i]) {
+            run = 0;
+            continue;
+        }
+        if (run++ == 0)
+            start = i;
+        if (run == blocks) {
+            memset(used + start, 1, blocks);
+            freeBlocks -= blocks;
+            buf = pool + start * SML_FRAME_BLOCK_SIZE;
+        }
+    }
+    portEXIT_CRITICAL(&poolLock);
+
+    if (buf != NULL)
+        *size = blocks * SML_FRAME_BLOCK_SIZE;
+    return buf;
+}
+
+
+// give back buffer of given size as returned by borrowFrameBuffer()
+void returnFrameBuffer(char *buf, uint16_t size) {
+    uint16_t start, blocks = size / SML_FRAME_BLOCK_SIZE;
+
+    if (buf == NULL || buf < pool || buf >= pool + sizeof(pool))
+        return;
+    start = (buf - pool) / SML_FRAME_BLOCK_SIZE;
+    if (start + blocks > SML_FRAME_BLOCKS)
+        return;
+
+    portENTER_CRITICAL(&poolLock);
+    memset(used + start, 0, blocks);
+    freeBlocks += blocks;
+    portEXIT_CRITICAL(&poolLock);
+}
+
+
+// unused bytes in pool (might be fragmented)
+uint16_t framePoolFree() {
+    return freeBlocks * SML_FRAME_BLOCK_SIZE;
+}
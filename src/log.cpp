@@ -0,0 +1,150 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include <stdarg.h>
+#include "log.h"
+#include "utils.h"
+
+// bounded multi-producer ring (one sequence number per entry), an entry
+// is free for the producer at position p if its sequence is p and ready
+// for the consumer if it is p + 1; producers claim positions with CAS
+typedef struct {
+    std::atomic<uint32_t> seq;
+    uint32_t millis;
+    uint8_t level;
+    char text[LOG_LINE_SIZE];
+} LogEntry;
+
+static LogEntry ring[LOG_RING_SIZE];
+static std::atomic<uint32_t> head{0};
+static std::atomic<uint32_t> dropped{0};
+static bool logStarted = false;
+static const char *prefix[] = { "", "[ERROR] ", "[WARN] ", "", "[DEBUG] " };
+
+#if (LOG_RING_SIZE & (LOG_RING_SIZE - 1)) != 0
+#error LOG_RING_SIZE must be a power of 2
+#endif
+
+
+static void formatMessage(char *buf, size_t size, uint32_t suppressed, const char *fmt, va_list args) {
+    int len = vsnprintf(buf, size, fmt, args);
+
+    if (suppressed > 0 && len >= 0 && len < (int)size)
+        snprintf(buf + len, size - len, " (%d suppressed)", suppressed);
+}
+
+
+// format message into a free ring entry, the message is dropped if the
+// ring is full or if its call site is rate limited (warnings, errors)
+void logWrite(uint8_t level, LogSite *site, const char *fmt, ...) {
+    uint32_t pos, now = millis(), suppressed = 0;
+    LogEntry *entry;
+    va_list args;
+    int32_t diff;
+
+    if (site != NULL) {
+        if (site->lastMillis != 0 && (now - site->lastMillis) < LOG_RATE_LIMIT_MS) {
+            site->suppressed++;
+            return;
+        }
+        site->lastMillis = now ? now : 1;
+        suppressed = site->suppressed.exchange(0);
+    }
+
+    if (!logStarted) {  // no log task yet (setup) or on the host
+        char text[LOG_LINE_SIZE];
+        va_start(args, fmt);
+        formatMessage(text, sizeof(text), suppressed, fmt, args);
+        va_end(args);
+        Serial.printf("%ld: %s%s\n", (long)now, prefix[level], text);
+        return;
+    }
+
+    pos = head.load(std::memory_order_relaxed);
+    while (1) {
+        entry = &ring[pos % LOG_RING_SIZE];
+        diff = (int32_t)(entry->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0 && head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        if (diff < 0) {  // ring is full
+            dropped++;
+            return;
+        }
+        if (diff > 0)
+            pos = head.load(std::memory_order_relaxed);
+    }
+
+    entry->millis = now;
+    entry->level = level;
+    va_start(args, fmt);
+    formatMessage(entry->text, sizeof(entry->text), suppressed, fmt, args);
+    va_end(args);
+    entry->seq.store(pos + 1, std::memory_order_release);
+}
+
+
+uint32_t droppedLogMessages() {
+    return dropped;
+}
+
+
+#ifndef SML_NATIVE
+static uint32_t tail = 0;  // only used by log task
+
+// vTask to print log messages in order, Serial is still shared with
+// multi-line output (e.g. readings) which is guarded by SerialLock
+static void logTask(void* parameter) {
+    uint32_t reported = 0;
+    LogEntry *entry;
+
+    while (1) {
+        entry = &ring[tail % LOG_RING_SIZE];
+        if ((int32_t)(entry->seq.load(std::memory_order_acquire) - (tail + 1)) < 0) {
+            if (dropped != reported) {
+                reported = dropped;
+                xSemaphoreTake(SerialLock, portMAX_DELAY);
+                Serial.printf("%ld: [WARN] %d log messages dropped so far\n", millis(), reported);
+                xSemaphoreGive(SerialLock);
+            }
+            vTaskDelay(LOG_DRAIN_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        xSemaphoreTake(SerialLock, portMAX_DELAY);
+        Serial.printf("%ld: %s%s\n", entry->millis, prefix[entry->level], entry->text);
+        xSemaphoreGive(SerialLock);
+        entry->seq.store(tail + LOG_RING_SIZE, std::memory_order_release);
+        tail++;
+    }
+}
+#endif
+
+
+// log messages are printed directly until the log task is started
+void startLog() {
+    uint32_t i;
+
+    for (i = 0; i < LOG_RING_SIZE; i++)
+        ring[i].seq.store(i, std::memory_order_relaxed);
+#ifndef SML_NATIVE
+    logStarted = true;
+    xTaskCreate(logTask, "log", 2048, NULL, 1, NULL);
+#endif
+}
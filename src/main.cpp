@@ -21,10 +21,14 @@
 #include "config.h"
 #include "smlparser.h"
 #include "smlreader.h"
+#include "obisregistry.h"
+#include "spool.h"
 #include "wlan.h"
 #include "mqtt.h"
 #include "rtc.h"
 #include "utils.h"
+#include "log.h"
+#include "profiler.h"
 
 
 void setup() {
@@ -41,21 +45,29 @@ void setup() {
     SerialLock = xSemaphoreCreateMutex();
     if (SerialLock == NULL)
         Serial.println(F("Failed to created mutex for Serial output!")); 
+    startLog();
 
+    loadOBISRegistry();
     startWifi();
     startNTPSync();
 #ifdef MQTT_BROKER
+    startSpool();
     startMQTT();
 #endif
 
 	for (uint8_t i = 0; i < sizeof(SMLReaderPins); i++) {
 		SMLReader *smlreader = new SMLReader(SMLReaderPins[i]);
         smlreaderList->push_back(smlreader);
+#ifndef SML_READER_SCHEDULER
         smlreader->startReader();
         smlreader->startPrinter();
+#endif
     }
-#ifdef DEBUG_MEMORY
-    xTaskCreate(debugTask, "Debug task", 2048, NULL, 10, NULL);
+#ifdef SML_READER_SCHEDULER
+    SMLReader::startScheduler();
+#endif
+#ifdef PROFILER_SECS
+    startProfiler();
 #endif
 }
 
@@ -63,14 +75,18 @@ void setup() {
 void loop() {
     static time_t lastPublishMillis = millis();
 
+#ifdef MQTT_ON_CHANGE
+    if ((millis() - lastPublishMillis) > MQTT_CHANGE_CHECK_MS) {
+#else
     if ((millis() - lastPublishMillis) > (MQTT_INTERVAL_SECS * 1000)) {
         blinkLED(1, 50);
-        xSemaphoreTake(SerialLock, portMAX_DELAY);
-        for (std::list<SMLReader*>::iterator it = smlreaderList->begin(); it != smlreaderList->end(); ++it) {
-            publishData((*it)->getReadings());
-        }
-        xSemaphoreGive(SerialLock);
+#endif
+        publishReadings();
         lastPublishMillis = millis();
     }
+    drainSpool();
+#ifdef SML_AGGREGATE_WINDOWS
+    publishAggregates();
+#endif
     esp_task_wdt_reset(); // feed the dog...
 }
\ No newline at end of file
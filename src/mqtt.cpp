@@ -24,164 +24,892 @@
 #include "wlan.h"
 #include "utils.h"
 #include "rtc.h"
+#include "msgpack.h"
+#include "spool.h"
+#include "mqttqueue.h"
+#include "log.h"
+#include "profiler.h"
+#include <atomic>
 
 static WiFiClient espClient;
 static WiFiClientSecure espClientSecure;
-static PubSubClient *mqtt = NULL;
+static PubSubClient *mqtt = NULL;  // only used by publisher task
+static TaskHandle_t publisherTask = NULL;
+static std::atomic<bool> online{false};  // set by publisher task
+static uint32_t lastUpdate = 0;  // millis() of last published message
 
+// counters of publisher task
+static std::atomic<uint32_t> publishedMessages{0};
+static std::atomic<uint32_t> failedMessages{0};
+static std::atomic<uint32_t> latencyMillis{0};  // sum of all published messages
+static std::atomic<uint32_t> maxLatencyMillis{0};  // since last metrics message
 
-// publish JSON on given MQTT topic
-static void publishJSON(JsonDocument& json, char *topic, bool retain) {
-#ifdef DEBUG_SML
-    static char buf[1280];
-#else
-    static char buf[512];
+#ifdef SML_CAPTURE_BYTES
+// pin of capture ring to be published (or MQTT_CAPTURE_ALL), set by
+// mqttCallback() which also runs in the publisher task
+static int16_t captureRequest = MQTT_CAPTURE_NONE;
 #endif
+
+
+static bool mqttUplink() {
+    return online.load();
+}
+
+
+// hand reserved queue slot over to publisher task
+static void queueMessage(MQTTMessage *msg, mqtt_msg_t type, uint8_t pin, uint32_t values, size_t len, bool retain) {
+    msg->type = type;
+    msg->pin = pin;
+    msg->values = values;
+    msg->len = len;
+    msg->retain = retain;
+    msg->queuedMillis = millis();
+    mqttQueuePush();
+    if (publisherTask != NULL)
+        xTaskNotifyGive(publisherTask);
+}
+
+
+// queue JSON message (state or metrics), false if it was not queued; a
+// queued message is replaced by a newer one of the same type and pin
+// unless 'coalesce' is cleared
+static bool publishJSON(JsonDocument& json, const char *topic, mqtt_msg_t type, uint8_t pin, bool retain,
+        bool coalesce = true) {
+    MQTTMessage *msg;
     size_t bytes;
 
-    Serial.print(millis());
-    if (mqtt == NULL || !mqtt->connected() || WiFi.status() != WL_CONNECTED) {
-        Serial.printf(": MQTT %s aborted, no MQTT or WiFi uplink!\n", topic);
-        return;
+    if (!mqttUplink() || (msg = mqttQueueReserve()) == NULL) {
+        logWarn("MQTT %s aborted, %s!", topic, mqttUplink() ? "queue is full" : "no MQTT or WiFi uplink");
+        json.clear();
+        return false;
     }
 
-    memset(buf, 0, sizeof(buf));
-    bytes = serializeJson(json, buf, sizeof(buf)-1);
-    if (json.overflowed()) {
-        Serial.printf(": MQTT %s aborted, JSON overflow (%d bytes)!\n", topic, bytes);
-    } else {
-        if (mqtt->publish(topic, buf, retain)) {
-            Serial.printf(": MQTT %s %s\n", topic, buf);
-        } else {
-            Serial.printf(": MQTT %s failed (%d bytes)!\n", topic, bytes);
-        }
+    bytes = serializeJson(json, msg->payload, sizeof(msg->payload));
+    if (json.overflowed() || bytes >= sizeof(msg->payload) - 1) {
+        logWarn("MQTT %s aborted, JSON overflow (%d bytes)!", topic, (int)bytes);
+        json.clear();
+        return false;
     }
     json.clear();
-    delay(100);
+    queueMessage(msg, type, pin, coalesce ? 0xffffffff : 0, bytes, retain);
+    return true;
 }
 
 
-// publish data on base topic as JSON
-void publishData(const SMLDeviceReadings &data) {
-    static uint32_t lastUpdate = 0;
-    char topicStr[128];
-#ifdef DEBUG_SML
-    StaticJsonDocument<1024> JSON;
-    static char smlmsg[1024];
-#else
+// publish startup or keepalive message on state topic if nothing
+// else has been published for MQTT_KEEPALIVE_SECS, never coalesced in
+// the queue so the broker sees every startup
+static void publishState() {
     StaticJsonDocument<256> JSON;
+    char topicStr[128];
+    time_t time_utc;
+
+    if (lastUpdate && (millis() - lastUpdate) <= (MQTT_KEEPALIVE_SECS * 1000))
+        return;
+
+    time(&time_utc);
+    if (!lastUpdate)
+        JSON["msgtype"] = "startup";
+    else
+        JSON["msgtype"] = "keealive";
+    JSON["timestamp"] = time_utc;
+    JSON["uptime"] = removeSpaces(getRuntime());
+    if (spooledReadings() > 0)
+        JSON["queued"] = spooledReadings();
+    if (droppedReadings() > 0)
+        JSON["dropped"] = droppedReadings();
+    JSON["txqueue"] = mqttQueueDepth();  // messages waiting for publisher task
+    if (mqttQueueRejected() > 0)
+        JSON["txfull"] = mqttQueueRejected();
+    if (mqttQueueCoalesced() > 0)
+        JSON["txcoalesced"] = mqttQueueCoalesced();
+    if (mqttQueueDropped() > 0)
+        JSON["txdropped"] = mqttQueueDropped();
+    lastUpdate = millis();
+    snprintf(topicStr, sizeof(topicStr), "%s/%s/state", MQTT_BASE_TOPIC, systemID().c_str());
+    publishJSON(JSON, topicStr, MQTT_MSG_STATE, 0, false, false);
+}
+
+
+#ifdef MQTT_METRICS_SECS
+// counters of reading heads on <base>/<sysid>/<pin>/metrics and of the
+// publisher on <base>/<sysid>/metrics every MQTT_METRICS_SECS
+static void publishMetrics() {
+    static uint32_t lastMetrics = 0, lastPublished = 0, lastLatency = 0, lastParseMicros = 0;
+    std::list<SMLReader*>::iterator it;
+    StaticJsonDocument<MQTT_METRICS_JSON_SIZE> JSON;
+    uint32_t published, latency, parseMicros = 0, frames;
+    SMLReaderStats stats;
+    char topicStr[128];
+    JsonArray sizes;
+    time_t time_utc;
+    uint8_t i;
+
+    if (lastMetrics && (millis() - lastMetrics) < (MQTT_METRICS_SECS * 1000))
+        return;
+    time(&time_utc);
+
+    for (it = smlreaderList->begin(); it != smlreaderList->end(); ++it) {
+        stats = (*it)->getStats();
+        frames = stats.frames + stats.checksumErrors + stats.overflows;
+        parseMicros += stats.parseMicros;
+        JSON["msgtype"] = "metrics";
+        JSON["timestamp"] = time_utc;
+        JSON["frames"] = stats.frames;
+        JSON["crcerrors"] = stats.checksumErrors;
+        JSON["overflows"] = stats.overflows;
+        JSON["aborted"] = stats.aborted;
+        JSON["unexpected"] = stats.unexpectedBytes;
+        JSON["bytes"] = stats.bytes;
+        JSON["rate"] = stats.bytesPerSec;
+        sizes = JSON.createNestedArray("sizes");  // per SML_FRAME_SIZE_STEP bytes
+        for (i = 0; i < SML_FRAME_SIZE_BUCKETS; i++)
+            sizes.add(stats.frameSizes[i]);
+        JSON["parsetime"] = frames ? (stats.parseMicros / frames) : 0;  // usecs
+        JSON["maxparsetime"] = stats.maxParseMicros;
+        if (stats.frames > 0)
+            JSON["age"] = (millis() - stats.lastFrameMillis) / 1000;
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/%d/metrics", MQTT_BASE_TOPIC, systemID().c_str(), stats.pin);
+        publishJSON(JSON, topicStr, MQTT_MSG_READER_METRICS, stats.pin, false);
+    }
+
+    published = publishedMessages;
+    latency = latencyMillis;
+    JSON["msgtype"] = "metrics";
+    JSON["timestamp"] = time_utc;
+    JSON["uptime"] = removeSpaces(getRuntime());
+    JSON["published"] = published;
+    JSON["failed"] = (uint32_t)failedMessages;
+    JSON["latency"] = (published != lastPublished) ? (latency - lastLatency) / (published - lastPublished) : 0;
+    JSON["maxlatency"] = maxLatencyMillis.exchange(0);
+    JSON["txqueue"] = mqttQueueDepth();
+    if (lastMetrics)  // share of CPU time spent parsing
+        JSON["parseload"] = (float)(parseMicros - lastParseMicros) / ((millis() - lastMetrics) * 10);
+    snprintf(topicStr, sizeof(topicStr), "%s/%s/metrics", MQTT_BASE_TOPIC, systemID().c_str());
+    publishJSON(JSON, topicStr, MQTT_MSG_METRICS, 0, false);
+
+    lastMetrics = millis();
+    lastPublished = published;
+    lastLatency = latency;
+    lastParseMicros = parseMicros;
+}
 #endif
+
+
+#ifdef PROFILER_SECS
+// heap usage and min. free stack and cpu share (per mille, PROFILER_CPU)
+// of all tasks from last profiler sample; tasks are split into several
+// messages ('part') if they don't fit into one
+static void publishProfile() {
+    static uint32_t lastProfile = 0;
+    StaticJsonDocument<MQTT_PROFILE_JSON_SIZE> JSON;
+    ProfileReport report;
+    char topicStr[128];
+    JsonObject tasks;
+    JsonArray task;
+    uint8_t i = 0, part = 0;
     time_t time_utc;
 
+    if (!getProfile(&report) || report.millis == lastProfile)
+        return;
+    lastProfile = report.millis;
     time(&time_utc);
-    JSON.clear();
-    if (!lastUpdate || (millis() - lastUpdate) > (MQTT_KEEPALIVE_SECS * 1000)) {
-        if (!lastUpdate)
-            JSON["msgtype"] = "startup";
-        else
-            JSON["msgtype"] = "keealive";
+    snprintf(topicStr, sizeof(topicStr), "%s/%s/profile", MQTT_BASE_TOPIC, systemID().c_str());
+
+    while (part == 0 || i < report.numTasks) {
+        JSON["msgtype"] = "profile";
         JSON["timestamp"] = time_utc;
-        JSON["uptime"] = removeSpaces(getRuntime());
-#ifdef DEBUG_MEMORY
-        JSON["heap"] = ESP.getFreeHeap();
+        JSON["part"] = part;
+        if (part == 0) {
+            JSON["heap"] = report.freeHeap;
+            JSON["minheap"] = report.minFreeHeap;
+            JSON["maxblock"] = report.maxBlock;
+            JSON["fragmentation"] = report.fragmentation;
+        }
+        tasks = JSON.createNestedObject("tasks");  // name: [stack, cpu]
+        for (; i < report.numTasks; i++) {
+            task = tasks.createNestedArray((char*)report.tasks[i].name);
+            task.add(report.tasks[i].stackFree);
+#ifdef PROFILER_CPU
+            if (report.cpuValid)
+                task.add(report.tasks[i].cpu);
 #endif
-        lastUpdate = millis();
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state", MQTT_BASE_TOPIC, systemID().c_str());
-        publishJSON(JSON, topicStr, false);
+            if (measureJson(JSON) >= MQTT_PAYLOAD_SIZE - 1 && tasks.size() > 1) {
+                tasks.remove((char*)report.tasks[i].name);  // next part
+                break;
+            }
+        }
+        if (!publishJSON(JSON, topicStr, MQTT_MSG_PROFILE, part++, false))
+            break;
     }
+}
+#endif
 
-    if (time_utc - data.timestamp > SML_DATA_EXPIRE_SECS) {
-        if (strlen((char*)data.manufacturer))
-            Serial.printf("%ld: Skipping MQTT update for %s/%s (pin %d), no recent data\n", 
-                millis(), data.manufacturer, data.serialnumber, data.pin);
-        else
-            Serial.printf("%ld: Skipping MQTT update (pin %d), no data\n", millis(), data.pin);
-        return;
-    
-    } else if (data.state == SML_CHECKSUM_ERROR) {
-        lastUpdate = millis();
+
+// check if there are recent readings of a reading head to publish
+static bool recentReadings(const SMLDeviceReadings &data) {
+    char serialnumber[21];
+    time_t time_utc;
+
+    time(&time_utc);
+    if (time_utc - data.timestamp <= SML_DATA_EXPIRE_SECS)
+        return true;
+
+    if (strlen((char*)data.manufacturer))
+        logInfo("Skipping MQTT update for %s/%s (pin %d), no recent data",
+            data.manufacturer, smlSerialnumber(data, serialnumber), data.pin);
+    else
+        logInfo("Skipping MQTT update (pin %d), no data", data.pin);
+    return false;
+}
+
+
+#ifndef MQTT_PAYLOAD_MSGPACK
+// readings of a reading head as JSON, limited to given value slots for
+// partial updates (msgtype 'change'), returns its size or 0 if too large
+static size_t encodeReadings(const SMLDeviceReadings &data, uint32_t values, bool partial,
+        const char *raw, uint16_t rawSize, bool withPin, char *buf, size_t size) {
+    StaticJsonDocument<MQTT_READINGS_JSON_SIZE> JSON;
+#ifdef DEBUG_SML
+    static char smlmsg[SML_MAX_MSG_SIZE * 2 + 1];
+#else
+    uint8_t slot;
+#endif
+    char serialnumber[21];
+    size_t bytes;
+
+    if (data.state == SML_CHECKSUM_ERROR) {
         JSON["msgtype"] = "error";
         JSON["timestamp"] = data.timestamp;
         JSON["error"] = "checksum";
         JSON["version"] = FIRMWARE_VERSION;
 
     } else if (data.state == SML_END) {
-        lastUpdate = millis();
         JSON["msgtype"] = "error";
         JSON["timestamp"] = data.timestamp;
         JSON["error"] = "buffer";
         JSON["version"] = FIRMWARE_VERSION;
 
     } else {
-        lastUpdate = millis();
-        JSON["msgtype"] = "data";
+        JSON["msgtype"] = partial ? "change" : "data";
         JSON["timestamp"] = data.timestamp;
 
         JSON["manufacturer"] = data.manufacturer;
-        JSON["serialnumber"] = data.serialnumber;
+        JSON["serialnumber"] = smlSerialnumber(data, serialnumber);
 #ifndef DEBUG_SML
-        if (data.energyFromGridTotal > LONG_MIN)
-            JSON["energyFromGridTotalkWh"] = data.energyFromGridTotal/1000;
-        if (data.energyToGridTotal > LONG_MIN)
-            JSON["energyToGridTotalkWh"] = data.energyToGridTotal/1000;
-        if (data.powerFromGridTotal > LONG_MIN)
-            JSON["powerFromGridTotalW"] = data.powerFromGridTotal;
-        if (data.powerToGridTotal > LONG_MIN)
-            JSON["powerToGridTotalW"] = data.powerToGridTotal;            
-        if (data.powerFromGridL1 > LONG_MIN)
-            JSON["powerFromGridL1W"] = data.powerFromGridL1;
-        if (data.powerFromGridL2 > LONG_MIN)
-            JSON["powerFromGridL2W"] = data.powerFromGridL2;
-        if (data.powerFromGridL3 > LONG_MIN)
-            JSON["powerFromGridL3W"] = data.powerFromGridL3;
+        for (slot = 0; slot < obisRegistrySlots(); slot++) {
+            if (smlHasValue(data, slot) && (values & (1UL << slot)))
+                JSON[(const char*)obisRegistrySlot(slot)->name] = smlValue(data, slot);
+        }
         JSON["version"] = FIRMWARE_VERSION;
 #else
         memset(smlmsg, 0, sizeof(smlmsg));
-        arr2str(data.fullMessage, data.msgSize, smlmsg);
-        JSON["sml"] = smlmsg;
+        if (raw != NULL)
+            arr2str(raw, rawSize, smlmsg);
+        JSON["sml"] = (const char*)smlmsg;  // not copied into JSON document
 #endif
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/%d/state",
-            MQTT_BASE_TOPIC, systemID().c_str(), data.pin);
-        publishJSON(JSON, topicStr, false);
     }
+    if (withPin)
+        JSON["pin"] = data.pin;
+
+    bytes = serializeJson(JSON, buf, size);
+    if (JSON.overflowed() || bytes >= size - 1) {
+        logWarn("MQTT update (pin %d) aborted, JSON overflow (%d bytes)!", data.pin, (int)bytes);
+        return 0;
+    }
+    return bytes;
 }
 
+#else
+// readings of a reading head as MessagePack map with numeric keys (see
+// mqtt.h), values are published as [value, scaler] in unit of meter;
+// limited to given value slots for partial updates (MQTT_KEY_CHANGE)
+static size_t encodeReadings(const SMLDeviceReadings &data, uint32_t values, bool partial,
+        const char *raw, uint16_t rawSize, bool withPin, char *buf, size_t size) {
+    uint8_t slot, entries;
+    msgpack_t mp;
+
+    mpInit(&mp, (uint8_t*)buf, size);
+    entries = 3 + (withPin ? 1 : 0);  // timestamp, version and error or manufacturer
+    if (data.state != SML_CHECKSUM_ERROR && data.state != SML_END) {
+        entries += partial ? 2 : 1;  // server id, change
+        for (slot = 0; slot < obisRegistrySlots(); slot++)
+            entries += (smlHasValue(data, slot) && (values & (1UL << slot))) ? 1 : 0;
+#ifdef DEBUG_SML
+        entries += (raw != NULL) ? 1 : 0;
+#endif
+    }
+
+    mpMap(&mp, entries);
+    if (withPin) {
+        mpUint(&mp, MQTT_KEY_PIN);
+        mpUint(&mp, data.pin);
+    }
+    mpUint(&mp, MQTT_KEY_TIMESTAMP);
+    mpUint(&mp, data.timestamp);
+    mpUint(&mp, MQTT_KEY_VERSION);
+    mpUint(&mp, FIRMWARE_VERSION);
+    if (data.state == SML_CHECKSUM_ERROR || data.state == SML_END) {
+        mpUint(&mp, MQTT_KEY_ERROR);
+        mpUint(&mp, (data.state == SML_CHECKSUM_ERROR) ? MQTT_ERROR_CHECKSUM : MQTT_ERROR_BUFFER);
+    } else {
+        mpUint(&mp, MQTT_KEY_MANUFACTURER);
+        mpStr(&mp, (const char*)data.manufacturer, strlen((const char*)data.manufacturer));
+        mpUint(&mp, MQTT_KEY_SERVERID);
+        mpBin(&mp, data.serverId, data.serverIdLen);
+        if (partial) {
+            mpUint(&mp, MQTT_KEY_CHANGE);
+            mpUint(&mp, 1);
+        }
+        for (slot = 0; slot < obisRegistrySlots(); slot++) {
+            if (!smlHasValue(data, slot) || !(values & (1UL << slot)))
+                continue;
+            mpUint(&mp, MQTT_KEY_VALUES + slot);
+            mpArray(&mp, 2);
+            mpInt(&mp, data.value[slot]);
+            mpInt(&mp, data.scaler[slot]);
+        }
+#ifdef DEBUG_SML
+        if (raw != NULL) {
+            mpUint(&mp, MQTT_KEY_SML);
+            mpBin(&mp, (const uint8_t*)raw, rawSize);
+        }
+#endif
+    }
+
+    if (mp.overflow) {
+        logWarn("MQTT update (pin %d) aborted, payload too large!", data.pin);
+        return 0;
+    }
+    return mp.len;
+}
+#endif
+
+
+#ifdef MQTT_ON_CHANGE
+// last published readings of a reading head
+typedef struct {
+    uint8_t pin;
+    uint8_t state;
+    uint32_t present;
+    time_t lastFull;  // all values were published
+    double value[OBIS_REGISTRY_SLOTS];
+} PublishedReadings;
+
+static PublishedReadings published[MQTT_ON_CHANGE_PINS];
+static uint8_t publishedPins = 0;
+
 
-// vTask to keep connection to MQTT server (with changing id on every attempt)
-static void mqttConnectionTask(void* parameter) {
+static PublishedReadings* publishedReadings(uint8_t pin) {
+    uint8_t i;
+
+    for (i = 0; i < publishedPins && published[i].pin != pin; i++);
+    if (i == publishedPins) {
+        if (publishedPins >= MQTT_ON_CHANGE_PINS)
+            return NULL;
+        memset(&published[i], 0, sizeof(PublishedReadings));
+        published[i].pin = pin;
+        publishedPins++;
+    }
+    return &published[i];
+}
+
+
+// value slots which moved beyond their deadband since they were last
+// published; all values are published on state changes (e.g. errors)
+// and at least every MQTT_MAX_SILENCE_SECS
+static uint32_t changedValues(const SMLDeviceReadings &data, PublishedReadings *last, bool *full) {
+    const OBISValueSlot *slot;
+    uint32_t changed = 0;
+    double value, threshold;
+    time_t time_utc;
+    uint8_t i;
+
+    time(&time_utc);
+    *full = (last == NULL || data.state != last->state || (time_utc - last->lastFull) >= MQTT_MAX_SILENCE_SECS);
+    if (*full)
+        return data.present;
+    if (data.state != SML_FINAL)  // unchanged error
+        return 0;
+
+    for (i = 0; i < obisRegistrySlots(); i++) {
+        if (!smlHasValue(data, i))
+            continue;
+        if (!(last->present & (1UL << i))) {
+            changed |= (1UL << i);
+            continue;
+        }
+        slot = obisRegistrySlot(i);
+        value = smlValue(data, i);
+        threshold = fabs(last->value[i]) * slot->deadbandPct / 100;
+        if (threshold < slot->deadband)
+            threshold = slot->deadband;
+        if (value != last->value[i] && fabs(value - last->value[i]) >= threshold)
+            changed |= (1UL << i);
+    }
+    return changed;
+}
+
+
+static void updatePublished(const SMLDeviceReadings &data, PublishedReadings *last, uint32_t values, bool full) {
+    uint8_t i;
+
+    if (last == NULL)
+        return;
+    for (i = 0; i < obisRegistrySlots(); i++) {
+        if (values & (1UL << i))
+            last->value[i] = smlValue(data, i);
+    }
+    last->present |= values;
+    last->state = data.state;
+    if (full) {
+        last->present = data.present;
+        time(&last->lastFull);
+    }
+}
+#endif
+
+
+#ifdef MQTT_BATCH
+// combined message with readings of several reading heads
+static char batch[MQTT_PAYLOAD_SIZE];
+static size_t batchSize = 0;
+static uint8_t batchCount = 0;
+#ifdef MQTT_PAYLOAD_MSGPACK
+static size_t batchCountPos;
+#endif
+
+
+static bool flushBatch() {
+    MQTTMessage *msg;
+
+    if (batchCount == 0)
+        return true;
+#ifdef MQTT_PAYLOAD_MSGPACK
+    batch[batchCountPos] = 0;  // number of meters (array 16)
+    batch[batchCountPos + 1] = batchCount;
+#else
+    batch[batchSize++] = ']';
+    batch[batchSize++] = '}';
+#endif
+    if ((msg = mqttQueueReserve()) != NULL) {
+        memcpy(msg->payload, batch, batchSize);
+        queueMessage(msg, MQTT_MSG_BATCH, 0, 0, batchSize, false);
+    } else {
+        logWarn("MQTT readings of %d meters aborted, queue is full!", batchCount);
+    }
+    batchSize = 0;
+    batchCount = 0;
+    return (msg != NULL);
+}
+
+
+// append readings of a reading head to combined message, which is
+// published before it would exceed MQTT_BATCH_MAX_BYTES; false if the
+// queue has no slot left for a new combined message
+static bool addBatch(const char *payload, size_t len) {
+    time_t time_utc;
+#ifdef MQTT_PAYLOAD_MSGPACK
+    msgpack_t mp;
+#endif
+
+    if (batchCount > 0 && batchSize + len + 3 > sizeof(batch))
+        flushBatch();
+    if (batchCount == 0) {
+        // slot stays free until flushBatch(), only this task queues messages
+        if (mqttQueueReserve() == NULL)
+            return false;
+        time(&time_utc);
+#ifdef MQTT_PAYLOAD_MSGPACK
+        mpInit(&mp, (uint8_t*)batch, sizeof(batch));
+        mpMap(&mp, 2);
+        mpUint(&mp, MQTT_KEY_METERS);
+        batch[mp.len++] = 0xdc;  // array 16, size is set on flush
+        batchCountPos = mp.len;
+        mp.len += 2;
+        mpUint(&mp, MQTT_KEY_TIMESTAMP);
+        mpUint(&mp, time_utc);
+        batchSize = mp.len;
+#else
+        batchSize = snprintf(batch, sizeof(batch), "{\"timestamp\":%ld,\"meters\":[", (long)time_utc);
+#endif
+    }
+    if (batchSize + len + 3 > sizeof(batch)) {
+        logWarn("MQTT readings aborted, too large (%d bytes)!", (int)len);
+        return true;
+    }
+#ifndef MQTT_PAYLOAD_MSGPACK
+    if (batchCount > 0)
+        batch[batchSize++] = ',';
+#endif
+    memcpy(batch + batchSize, payload, len);
+    batchSize += len;
+    batchCount++;
+    return true;
+}
+#endif
+
+
+// queue readings of a reading head for the publisher task (added to
+// combined message with MQTT_BATCH_PUBLISH), false if queue is full;
+// live readings may be replaced by newer ones if the uplink is slow
+static bool publishRecord(const SMLDeviceReadings &data, uint32_t values, bool partial,
+        const char *raw, uint16_t rawSize, bool live) {
+#ifdef MQTT_BATCH
+    static char buf[MQTT_PAYLOAD_SIZE];
+#else
+    MQTTMessage *msg;
+#endif
+    size_t len;
+
+#ifdef MQTT_BATCH
+    len = encodeReadings(data, values, partial, raw, rawSize, true, buf, sizeof(buf));
+    if (len > 0)
+        return addBatch(buf, len);
+    return true;
+#else
+    if ((msg = mqttQueueReserve()) == NULL)
+        return false;
+    len = encodeReadings(data, values, partial, raw, rawSize, false, msg->payload, sizeof(msg->payload));
+    if (len > 0)
+        queueMessage(msg, MQTT_MSG_READINGS, data.pin, live ? (partial ? values : 0xffffffff) : 0, len, false);
+    return true;
+#endif
+}
+
+
+// publish readings of all reading heads, either as one message per
+// pin on <base>/<sysid>/<pin>/state or (MQTT_BATCH_PUBLISH) combined
+// in as few messages on <base>/<sysid>/readings as possible; with
+// MQTT_ON_CHANGE only values which changed are published
+void publishReadings() {
+    std::list<SMLReader*>::iterator it;
+    SMLDeviceReadings data;
+    uint32_t values;
+    bool full = true;
+#ifdef MQTT_ON_CHANGE
+    PublishedReadings *last;
+#endif
+#ifdef DEBUG_SML
+    static char raw[SML_MAX_MSG_SIZE];
+    uint16_t rawSize = 0;
+#else
+    const char *raw = NULL;
+    uint16_t rawSize = 0;
+#endif
+
+    publishState();
+#ifdef MQTT_METRICS_SECS
+    publishMetrics();
+#endif
+#ifdef PROFILER_SECS
+    publishProfile();
+#endif
+    for (it = smlreaderList->begin(); it != smlreaderList->end(); ++it) {
+        data = (*it)->getReadings();
+#ifdef MQTT_ON_CHANGE
+        last = publishedReadings(data.pin);
+        if (time(NULL) - data.timestamp > SML_DATA_EXPIRE_SECS) {
+            if (last == NULL || (time(NULL) - last->lastFull) >= MQTT_MAX_SILENCE_SECS) {
+                recentReadings(data);  // log missing data with every heartbeat
+                if (last != NULL) {
+                    last->state = SML_UNEXPECTED;  // publish all values when data returns
+                    time(&last->lastFull);
+                }
+            }
+            continue;
+        }
+        if ((values = changedValues(data, last, &full)) == 0 && !full)
+            continue;
+#else
+        if (!recentReadings(data))
+            continue;
+        values = data.present;
+#endif
+#ifdef DEBUG_SML
+        rawSize = (*it)->getRawMessage(raw, sizeof(raw));
+#endif
+        if (!mqttUplink() || !publishRecord(data, values, !full, raw, rawSize, true))
+            spoolReadings(data, values, !full);  // publish later
+#ifdef MQTT_ON_CHANGE
+        updatePublished(data, last, values, full);
+#endif
+        lastUpdate = millis();
+    }
+#ifdef MQTT_BATCH
+    flushBatch();
+#endif
+}
+
+
+#ifdef SML_AGGREGATE_WINDOWS
+// part of an aggregation window with values starting at given slot,
+// [min, mean, max] of power values and change of energy values; returns
+// slot to continue with in next part
+static uint8_t encodeAggregate(JsonDocument &JSON, const SMLAggregate &window, uint8_t part, uint8_t slot) {
+    const SMLAggregateValue *value;
+    JsonArray power;
+    const char *name;
+
+    JSON["msgtype"] = "aggregate";
+    JSON["timestamp"] = window.start;
+    JSON["window"] = window.secs;
+    JSON["part"] = part;
+    JSON["frames"] = window.frames;
+    JSON["first"] = window.first;
+    JSON["last"] = window.last;
+    for (; slot < obisRegistrySlots(); slot++) {
+        if (!(window.present & (1UL << slot)))
+            continue;
+        value = &window.values[slot];
+        name = obisRegistrySlot(slot)->name;
+        if (aggregatePower(slot)) {
+            power = JSON.createNestedArray(name);
+            power.add(aggregateValue(value->min, value->scaler, slot));
+            power.add(aggregateValue(value->sum, value->scaler, slot) / value->count);
+            power.add(aggregateValue(value->max, value->scaler, slot));
+        } else {
+            JSON[name] = aggregateValue(value->max, value->scaler, slot) -
+                aggregateValue(value->min, value->scaler, slot);
+        }
+        if (measureJson(JSON) >= MQTT_PAYLOAD_SIZE - 1 && JSON.size() > 8) {
+            JSON.remove(name);  // next part
+            break;
+        }
+    }
+    return slot;
+}
+
+
+// publish windows closed since last call on <base>/<sysid>/<pin>/aggregate,
+// split into several messages ('part') if needed; a window is only taken
+// from its reader once all parts are queued, otherwise it's retried with
+// the next call until the next window of the same length closes
+void publishAggregates() {
+    std::list<SMLReader*>::iterator it;
+    StaticJsonDocument<MQTT_AGGREGATE_JSON_SIZE> JSON;
+    SMLAggregate window;
+    char topicStr[128];
+    uint8_t w, slot, part, parts, pin;
+    uint32_t closed;
+    bool queued;
+
+    if (!mqttUplink())
+        return;
+
+    for (it = smlreaderList->begin(); it != smlreaderList->end(); ++it) {
+        pin = (*it)->getStats().pin;
+        for (w = 0; w < SML_AGGREGATE_COUNT; w++) {
+            if ((closed = (*it)->peekAggregate(w, &window)) == 0)
+                continue;
+
+            // queue slots are only released by the publisher task
+            for (parts = 0, slot = 0; parts == 0 || slot < obisRegistrySlots(); parts++) {
+                slot = encodeAggregate(JSON, window, parts, slot);
+                JSON.clear();
+            }
+            if (MQTT_QUEUE_SLOTS - mqttQueueDepth() < parts)
+                return;
+
+            snprintf(topicStr, sizeof(topicStr), "%s/%s/%d/aggregate", MQTT_BASE_TOPIC, systemID().c_str(), pin);
+            queued = true;
+            for (part = 0, slot = 0; queued && part < parts; part++) {
+                slot = encodeAggregate(JSON, window, part, slot);
+                queued = publishJSON(JSON, topicStr, MQTT_MSG_AGGREGATE, pin, false, false);
+            }
+            if (queued)
+                (*it)->commitAggregate(w, closed);
+        }
+    }
+}
+#endif
+
+
+// publish readings queued during an outage (at most MQTT_SPOOL_DRAIN_RATE
+// per second) or write pending readings to flash while still offline
+void drainSpool() {
+    static uint32_t lastDrain = 0;
+    SpoolRecord rec;
+    bool published;
+
+    if (!mqttUplink()) {
+        flushSpool(false);
+        return;
+    }
+    if (spooledReadings() == 0 || mqttQueueDepth() > 0 ||
+            (millis() - lastDrain) < (1000 / MQTT_SPOOL_DRAIN_RATE))
+        return;
+    lastDrain = millis();
+
+    if (peekSpool(&rec)) {
+        published = publishRecord(rec.data, rec.values, rec.partial, NULL, 0, false);
+#ifdef MQTT_BATCH
+        published = flushBatch() && published;
+#endif
+        if (published)
+            popSpool();
+    }
+}
+
+
+#ifdef SML_CAPTURE_BYTES
+// capture download requested on <base>/<sysid>/capture/get, payload is
+// the pin of a reading head or empty for all reading heads
+static void mqttCallback(char *topic, byte *payload, unsigned int length) {
+    char pin[4];
+
+    if (length == 0) {
+        captureRequest = MQTT_CAPTURE_ALL;
+    } else if (length < sizeof(pin)) {
+        memcpy(pin, payload, length);
+        pin[length] = '\0';
+        captureRequest = atoi(pin);
+    }
+}
+
+
+// stream capture rings on <base>/<sysid>/<pin>/capture, published by the
+// publisher task directly since they don't fit into a queue slot
+static void publishCapture() {
+    static uint8_t buf[SML_CAPTURE_BYTES];
+    std::list<SMLReader*>::iterator it;
+    char topicStr[128];
+    uint16_t size;
+    uint8_t pin;
+    bool published;
+
+    for (it = smlreaderList->begin(); it != smlreaderList->end(); ++it) {
+        pin = (*it)->getStats().pin;
+        if (captureRequest != MQTT_CAPTURE_ALL && captureRequest != pin)
+            continue;
+        size = (*it)->getCapture(buf);
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/%d/capture", MQTT_BASE_TOPIC, systemID().c_str(), pin);
+        published = mqtt->beginPublish(topicStr, size, false) &&
+            mqtt->write(buf, size) == size && mqtt->endPublish();
+        if (published)
+            logInfo("MQTT %s (%d bytes)", topicStr, size);
+        else
+            logWarn("MQTT %s failed (%d bytes)!", topicStr, size);
+    }
+    captureRequest = MQTT_CAPTURE_NONE;
+}
+#endif
+
+
+// (re)connect to MQTT server with changing id on every attempt
+static void connectMQTT() {
     static char clientid[32];
+#ifdef SML_CAPTURE_BYTES
+    char topicStr[128];
+#endif
+    bool connected;
 
-    Serial.printf("%ld: Starting MQTT connection task with interval %d secs\n", millis(), MQTT_CHECK_SECS);
+    if (!WiFi.isConnected()) {
+        logInfo("WiFi not available, cannot connect to MQTT broker %s", MQTT_BROKER);
+        wifiReconnect();
+        return;
+    }
+
+    if (mqtt->connected()) {
+        logInfo("Connection to MQTT broker %s ready", MQTT_BROKER);
+        return;
+    }
+    snprintf(clientid, sizeof(clientid), MQTT_CLIENT_ID, (int)random(0xfffff));
+#if defined(MQTT_USERNAME) && defined(MQTT_PASSWORD)
+    logInfo("Connecting to MQTT broker %s with username %s on port %d...",
+        MQTT_BROKER, MQTT_USERNAME, MQTT_BROKER_PORT);
+    connected = mqtt->connect(clientid, MQTT_USERNAME, MQTT_PASSWORD);
+#else
+    logInfo("Connecting to MQTT broker %s on port %d...", MQTT_BROKER, MQTT_BROKER_PORT);
+    connected = mqtt->connect(clientid);
+#endif
+    if (connected) {
+        logInfo("Connected to MQTT broker %s", MQTT_BROKER);
+#ifdef SML_CAPTURE_BYTES
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/capture/get", MQTT_BASE_TOPIC, systemID().c_str());
+        mqtt->subscribe(topicStr);
+#endif
+    } else {
+        logWarn("Connecting to MQTT broker %s failed (error %d)", MQTT_BROKER, mqtt->state());
+        blinkLED(2, 50);
+    }
+}
+
+
+// publish queued message on its MQTT topic
+static bool sendMessage(const MQTTMessage *msg) {
+    char topicStr[128];
+    uint32_t latency;
+    bool published;
+
+    if (msg->type == MQTT_MSG_READINGS)
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/%d/state", MQTT_BASE_TOPIC, systemID().c_str(), msg->pin);
+    else if (msg->type == MQTT_MSG_BATCH)
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/readings", MQTT_BASE_TOPIC, systemID().c_str());
+    else if (msg->type == MQTT_MSG_METRICS)
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/metrics", MQTT_BASE_TOPIC, systemID().c_str());
+    else if (msg->type == MQTT_MSG_READER_METRICS)
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/%d/metrics", MQTT_BASE_TOPIC, systemID().c_str(), msg->pin);
+    else if (msg->type == MQTT_MSG_AGGREGATE)
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/%d/aggregate", MQTT_BASE_TOPIC, systemID().c_str(), msg->pin);
+    else if (msg->type == MQTT_MSG_PROFILE)
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/profile", MQTT_BASE_TOPIC, systemID().c_str());
+    else
+        snprintf(topicStr, sizeof(topicStr), "%s/%s/state", MQTT_BASE_TOPIC, systemID().c_str());
+
+    published = mqtt->publish(topicStr, (const uint8_t*)msg->payload, msg->len, msg->retain);
+    if (published) {
+        latency = millis() - msg->queuedMillis;
+        publishedMessages++;
+        latencyMillis += latency;
+        if (latency > maxLatencyMillis)
+            maxLatencyMillis = latency;
+    } else {
+        failedMessages++;
+    }
+    if (!published)
+        logWarn("MQTT %s failed (%d bytes)!", topicStr, (int)msg->len);
+    else if (msg->payload[0] != '{')  // only JSON is logged
+        logInfo("MQTT %s (%d bytes)", topicStr, (int)msg->len);
+    else  // truncated to a log line
+        logInfo("MQTT %s %.*s", topicStr, (int)(msg->len < LOG_LINE_SIZE ? msg->len : LOG_LINE_SIZE),
+            msg->payload);
+    return published;
+}
+
+
+// vTask which owns the MQTT client, keeps the connection to the MQTT
+// server and publishes queued messages as soon as they are available;
+// messages stay queued while the uplink is down
+static void mqttPublisherTask(void* parameter) {
+    uint32_t lastCheck = 0;
+    MQTTMessage *msg;
+
+    logInfo("Starting MQTT publisher task with connection check every %d secs", MQTT_CHECK_SECS);
     while (1) {
-        xSemaphoreTake(SerialLock, portMAX_DELAY);
-        if (!WiFi.isConnected()) {
-            Serial.printf("%ld: WiFi not available, cannot connect to MQTT broker %s\n", millis(), MQTT_BROKER);
-            wifiReconnect();
-        } else if (mqtt->connected()) {
-            Serial.printf("%ld: Connection to MQTT broker %s ready\n", millis(), MQTT_BROKER);
-        } else {
-            snprintf(clientid, sizeof(clientid), MQTT_CLIENT_ID, (int)random(0xfffff));
-            Serial.printf("%ld: Connecting to MQTT broker %s", millis(), MQTT_BROKER);
-    #if defined(MQTT_USERNAME) && defined(MQTT_PASSWORD)
-                Serial.printf(" with username %s", MQTT_USERNAME);
-    #endif
-            Serial.printf(" on port %d...", MQTT_BROKER_PORT);
-    #if defined(MQTT_USERNAME) && defined(MQTT_PASSWORD)
-            if (mqtt->connect(clientid, MQTT_USERNAME, MQTT_PASSWORD)) {
-                Serial.println(F("OK"));
-            } else {
-    #else
-            if (mqtt->connect(clientid)) {
-                Serial.println(F("OK"));
-            } else {
-    #endif
-                Serial.printf("failed (error %d)\n", mqtt->state());
-                blinkLED(2, 50);
+        if (!lastCheck || (millis() - lastCheck) >= (MQTT_CHECK_SECS * 1000)) {
+            connectMQTT();
+            lastCheck = millis();
+        }
+        online = (mqtt->connected() && WiFi.status() == WL_CONNECTED);
+
+        if (online) {
+            mqtt->loop();
+#ifdef SML_CAPTURE_BYTES
+            if (captureRequest != MQTT_CAPTURE_NONE)
+                publishCapture();
+#endif
+            while ((msg = mqttQueuePeek()) != NULL) {
+                if (sendMessage(msg)) {
+                    mqttQueuePop();
+                } else {
+                    if (mqtt->connected())  // retried after reconnecting otherwise
+                        mqttQueueDrop();
+                    break;
+                }
             }
         }
-        xSemaphoreGive(SerialLock); 
-        printFreeStackWatermark("mqttconnect_task");
-        vTaskDelay((MQTT_CHECK_SECS * 1000) / portTICK_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, MQTT_PUBLISH_WAIT_MS / portTICK_PERIOD_MS);
     }
 }
 
@@ -196,19 +924,18 @@ void startMQTT() {
     mqtt = new PubSubClient(espClient);
 #endif
     mqtt->setServer(MQTT_BROKER, MQTT_BROKER_PORT);
-#ifdef DEBUG_SML
-    mqtt->setBufferSize(1024);
-#else
-    mqtt->setBufferSize(640);
-#endif
+    mqtt->setBufferSize(MQTT_PAYLOAD_SIZE + 128);  // payload and topic
     mqtt->setSocketTimeout(2); // avoid blocking
     mqtt->setKeepAlive(MQTT_KEEPALIVE_SECS);
+#ifdef SML_CAPTURE_BYTES
+    mqtt->setCallback(mqttCallback);
+#endif
 
 #ifdef MQTT_TLS
-    xTaskCreate(mqttConnectionTask, "MQTT reconnect task", 3840, NULL, 2, NULL);
+    xTaskCreate(mqttPublisherTask, "mqttpublisher", 4096, NULL, 2, &publisherTask);
 #else
-    xTaskCreate(mqttConnectionTask, "MQTT reconnect task", 2048, NULL, 2, NULL);
+    xTaskCreate(mqttPublisherTask, "mqttpublisher", 3072, NULL, 2, &publisherTask);
 #endif
-    while (!mqtt->connected() && timeout++ < MQTT_CONNECT_WAIT_SECS*2)
+    while (!mqttUplink() && timeout++ < MQTT_CONNECT_WAIT_SECS*2)
         delay(500);
-}
\ No newline at end of file
+}
@@ -0,0 +1,111 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include <atomic>
+#include "mqttqueue.h"
+
+#if (MQTT_QUEUE_SLOTS & (MQTT_QUEUE_SLOTS - 1)) != 0
+#error MQTT_QUEUE_SLOTS must be a power of 2
+#endif
+
+// ring of messages indexed by free running counters, 'head' is only
+// written by the producer and 'tail' only by the consumer, so slots
+// between both can be read without locking
+static MQTTMessage queue[MQTT_QUEUE_SLOTS];
+static std::atomic<uint32_t> head{0};
+static std::atomic<uint32_t> tail{0};
+static std::atomic<uint32_t> rejected{0};  // queue was full
+static std::atomic<uint32_t> dropped{0};  // publishing failed
+static std::atomic<uint32_t> coalesced{0};
+
+
+// next free slot to encode a message into or NULL if queue is full
+MQTTMessage* mqttQueueReserve() {
+    uint32_t h = head.load(std::memory_order_relaxed);
+
+    if (h - tail.load(std::memory_order_acquire) >= MQTT_QUEUE_SLOTS) {
+        rejected++;
+        return NULL;
+    }
+    return &queue[h % MQTT_QUEUE_SLOTS];
+}
+
+
+// hand reserved slot over to consumer
+void mqttQueuePush() {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+// oldest message which has not been superseded by a newer one
+MQTTMessage* mqttQueuePeek() {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t h = head.load(std::memory_order_acquire);
+    MQTTMessage *msg, *next;
+    uint32_t i;
+
+    while (t != h) {
+        msg = &queue[t % MQTT_QUEUE_SLOTS];
+        for (i = t + 1; i != h; i++) {
+            next = &queue[i % MQTT_QUEUE_SLOTS];
+            if (msg->values != 0 && next->type == msg->type && next->pin == msg->pin &&
+                    (next->values & msg->values) == msg->values)
+                break;
+        }
+        if (i == h)
+            return msg;
+        tail.store(++t, std::memory_order_release);
+        coalesced++;
+    }
+    return NULL;
+}
+
+
+// remove published message
+void mqttQueuePop() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+// remove message which could not be published
+void mqttQueueDrop() {
+    mqttQueuePop();
+    dropped++;
+}
+
+
+uint32_t mqttQueueDepth() {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+
+uint32_t mqttQueueRejected() {
+    return rejected;
+}
+
+
+uint32_t mqttQueueDropped() {
+    return dropped;
+}
+
+
+uint32_t mqttQueueCoalesced() {
+    return coalesced;
+}
@@ -0,0 +1,122 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include <string.h>
+#include "msgpack.h"
+
+
+void mpInit(msgpack_t *mp, uint8_t *buf, size_t size) {
+    mp->buf = buf;
+    mp->size = size;
+    mp->len = 0;
+    mp->overflow = false;
+}
+
+
+// type byte followed by 'bytes' bytes of given value (big endian)
+static void put(msgpack_t *mp, uint8_t type, uint64_t val, uint8_t bytes) {
+    if (mp->len + bytes + 1 > mp->size) {
+        mp->overflow = true;
+        return;
+    }
+    mp->buf[mp->len++] = type;
+    while (bytes-- > 0)
+        mp->buf[mp->len++] = val >> (bytes * 8);
+}
+
+
+static void putData(msgpack_t *mp, const void *data, size_t len) {
+    if (mp->len + len > mp->size) {
+        mp->overflow = true;
+        return;
+    }
+    memcpy(mp->buf + mp->len, data, len);
+    mp->len += len;
+}
+
+
+void mpMap(msgpack_t *mp, uint16_t entries) {
+    if (entries < 16)
+        put(mp, 0x80 | entries, 0, 0);  // fixmap
+    else
+        put(mp, 0xde, entries, 2);  // map 16
+}
+
+
+void mpArray(msgpack_t *mp, uint16_t entries) {
+    if (entries < 16)
+        put(mp, 0x90 | entries, 0, 0);  // fixarray
+    else
+        put(mp, 0xdc, entries, 2);  // array 16
+}
+
+
+// smallest encoding of unsigned integer
+void mpUint(msgpack_t *mp, uint64_t val) {
+    if (val < 128)
+        put(mp, val, 0, 0);  // positive fixint
+    else if (val <= 0xFF)
+        put(mp, 0xcc, val, 1);
+    else if (val <= 0xFFFF)
+        put(mp, 0xcd, val, 2);
+    else if (val <= 0xFFFFFFFF)
+        put(mp, 0xce, val, 4);
+    else
+        put(mp, 0xcf, val, 8);
+}
+
+
+// smallest encoding of signed integer
+void mpInt(msgpack_t *mp, int64_t val) {
+    if (val >= 0)
+        mpUint(mp, val);
+    else if (val >= -32)
+        put(mp, (uint8_t)val, 0, 0);  // negative fixint
+    else if (val >= INT8_MIN)
+        put(mp, 0xd0, (uint8_t)val, 1);
+    else if (val >= INT16_MIN)
+        put(mp, 0xd1, (uint16_t)val, 2);
+    else if (val >= INT32_MIN)
+        put(mp, 0xd2, (uint32_t)val, 4);
+    else
+        put(mp, 0xd3, (uint64_t)val, 8);
+}
+
+
+void mpStr(msgpack_t *mp, const char *str, size_t len) {
+    if (len > 0xFF)
+        len = 0xFF;
+    if (len < 32)
+        put(mp, 0xa0 | len, 0, 0);  // fixstr
+    else
+        put(mp, 0xd9, len, 1);  // str 8
+    putData(mp, str, len);
+}
+
+
+void mpBin(msgpack_t *mp, const uint8_t *data, size_t len) {
+    if (len > 0xFFFF)
+        len = 0xFFFF;
+    if (len <= 0xFF)
+        put(mp, 0xc4, len, 1);
+    else
+        put(mp, 0xc5, len, 2);
+    putData(mp, data, len);
+}
@@ -0,0 +1,216 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "obisregistry.h"
+#include "smldecoder.h"
+#include "utils.h"
+#include "log.h"
+#ifndef SML_NATIVE
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#endif
+
+#define OBIS_HASH_BITS 6
+#define OBIS_HASH_SIZE (1 << OBIS_HASH_BITS)
+
+static_assert(OBIS_REGISTRY_CODES < OBIS_HASH_SIZE, "OBIS hash table too small");
+static_assert(OBIS_REGISTRY_SLOTS <= 32, "presence of values is kept in 32 bit mask");
+
+// values published if no registry file is found
+static const struct {
+    const char *name;
+    const char *label;
+    uint8_t unit;
+    int8_t scale;
+    float deadband;
+    uint8_t deadbandPct;
+    const char *obis[2];
+} OBISDefaults[] = {
+    { "energyFromGridTotalkWh", "Total Consumption", SML_WATT_HOUR, 3, 0.01, 0, { "1-0:1.8.0*255" } },
+    { "energyToGridTotalkWh", "Total Feed to Grid", SML_WATT_HOUR, 3, 0.01, 0, { "1-0:2.8.0*255" } },
+    { "powerFromGridTotalW", "Total Active Power", SML_WATT, 0, 20, 5, { "1-0:16.7.0*255" } },
+    { "powerToGridTotalW", "Total Active Power to Grid", SML_WATT, 0, 20, 5, { "1-0:15.7.0*255" } },
+    { "powerFromGridL1W", "Active Power L1", SML_WATT, 0, 20, 5, { "1-0:36.7.0*255", "1-0:21.7.0*255" } },
+    { "powerFromGridL2W", "Active Power L2", SML_WATT, 0, 20, 5, { "1-0:56.7.0*255", "1-0:41.7.0*255" } },
+    { "powerFromGridL3W", "Active Power L3", SML_WATT, 0, 20, 5, { "1-0:76.7.0*255", "1-0:61.7.0*255" } },
+};
+
+// DLMS unit codes (sml_units_t) used in registry file
+static const struct {
+    uint8_t code;
+    const char *name;
+} OBISUnits[] = {
+    { 27, "W" }, { 28, "VA" }, { 29, "var" }, { 30, "Wh" }, { 31, "VAh" }, { 32, "varh" },
+    { 33, "A" }, { 35, "V" }, { 44, "Hz" }, { 13, "m3" }, { 9, "C" }, { 255, "" }
+};
+
+// registry is filled once at boot and read-only afterwards, so
+// readers can look up OBIS codes concurrently without locking
+static OBISValueSlot slots[OBIS_REGISTRY_SLOTS];
+static uint8_t numSlots = 0;
+static uint8_t numCodes = 0;
+static struct {
+    uint64_t key;
+    uint8_t slot;  // value slot + 1, 0 if empty
+} codes[OBIS_HASH_SIZE];
+
+
+static inline uint8_t hashKey(uint64_t key) {
+    return ((uint32_t)(key ^ (key >> 32)) * 0x9E3779B1) >> (32 - OBIS_HASH_BITS);
+}
+
+
+static void clearRegistry() {
+    numSlots = 0;
+    numCodes = 0;
+    memset(codes, 0, sizeof(codes));
+}
+
+
+bool addOBISRegistrySlot(const char *name, const char *label, uint8_t unit, int8_t scale,
+        float deadband, uint8_t deadbandPct) {
+    if (numSlots >= OBIS_REGISTRY_SLOTS || name == NULL || strlen(name) == 0)
+        return false;
+    snprintf(slots[numSlots].name, sizeof(slots[numSlots].name), "%s", name);
+    snprintf(slots[numSlots].label, sizeof(slots[numSlots].label), "%s",
+        (label != NULL && strlen(label) > 0) ? label : name);
+    slots[numSlots].unit = unit;
+    slots[numSlots].scale = scale;
+    slots[numSlots].deadband = deadband;
+    slots[numSlots].deadbandPct = deadbandPct;
+    numSlots++;
+    return true;
+}
+
+
+// map OBIS code (e.g. "1-0:1.8.0*255") to given value slot
+bool addOBISRegistryCode(const char *obis, uint8_t slot) {
+    uint8_t a, b, c, d, e, f = 255, h;
+    uint64_t key;
+
+    if (obis == NULL || slot >= numSlots || numCodes >= OBIS_REGISTRY_CODES)
+        return false;
+    if (sscanf(obis, "%hhu-%hhu:%hhu.%hhu.%hhu*%hhu", &a, &b, &c, &d, &e, &f) < 5)
+        return false;
+    key = ((uint64_t)a << 40) | ((uint64_t)b << 32) | ((uint64_t)c << 24) |
+        ((uint64_t)d << 16) | ((uint64_t)e << 8) | f;
+    for (h = hashKey(key); codes[h].slot != 0; h = (h + 1) & (OBIS_HASH_SIZE - 1)) {
+        if (codes[h].key == key)
+            return false;  // OBIS code already mapped
+    }
+    codes[h].key = key;
+    codes[h].slot = slot + 1;
+    numCodes++;
+    return true;
+}
+
+
+void defaultOBISRegistry() {
+    clearRegistry();
+    for (uint8_t i = 0; i < sizeof(OBISDefaults) / sizeof(OBISDefaults[0]); i++) {
+        addOBISRegistrySlot(OBISDefaults[i].name, OBISDefaults[i].label, OBISDefaults[i].unit,
+            OBISDefaults[i].scale, OBISDefaults[i].deadband, OBISDefaults[i].deadbandPct);
+        for (uint8_t j = 0; j < 2 && OBISDefaults[i].obis[j] != NULL; j++)
+            addOBISRegistryCode(OBISDefaults[i].obis[j], i);
+    }
+}
+
+
+// load value slots from registry file in LittleFS, e.g.
+// { "values": [ { "name": "voltageL1V", "label": "Voltage L1", "unit": "V",
+//   "scale": 0, "deadband": 2, "obis": [ "1-0:32.7.0*255" ] }, ... ] }
+// falls back to default registry if file is missing or invalid
+void loadOBISRegistry() {
+#ifndef SML_NATIVE
+    DynamicJsonDocument JSON(4096);
+    DeserializationError err;
+    uint8_t unit;
+    File file;
+
+    if (LittleFS.begin(false) && (file = LittleFS.open(OBIS_REGISTRY_FILE, "r"))) {
+        err = deserializeJson(JSON, file);
+        file.close();
+        if (err) {
+            logWarn("Failed to parse %s: %s", OBIS_REGISTRY_FILE, err.c_str());
+        } else {
+            clearRegistry();
+            for (JsonObject value : JSON["values"].as<JsonArray>()) {
+                unit = value["unit"].is<int>() ? value["unit"].as<uint8_t>() : obisUnitCode(value["unit"] | "");
+                if (!addOBISRegistrySlot(value["name"], value["label"], unit, value["scale"] | 0,
+                        value["deadband"] | 0.0, value["deadbandPct"] | 0)) {
+                    // warnings of every skipped entry, not rate limited
+                    LOG_AT(LOG_WARN, NULL, "Skipping OBIS registry entry '%s'", value["name"] | "");
+                    continue;
+                }
+                if (value["obis"].is<const char*>())
+                    addOBISRegistryCode(value["obis"], numSlots - 1);
+                else
+                    for (const char *obis : value["obis"].as<JsonArray>())
+                        if (!addOBISRegistryCode(obis, numSlots - 1))
+                            LOG_AT(LOG_WARN, NULL, "Skipping OBIS code %s", obis);
+            }
+            logInfo("Loaded %d values (%d OBIS codes) from %s", numSlots, numCodes, OBIS_REGISTRY_FILE);
+            if (numSlots > 0)
+                return;
+        }
+    }
+    logInfo("Using default OBIS registry");
+#endif
+    defaultOBISRegistry();
+}
+
+
+// value slot for given OBIS code or -1 if not registered
+int8_t obisRegistryLookup(uint64_t key) {
+    uint8_t h;
+
+    for (h = hashKey(key); codes[h].slot != 0; h = (h + 1) & (OBIS_HASH_SIZE - 1)) {
+        if (codes[h].key == key)
+            return codes[h].slot - 1;
+    }
+    return -1;
+}
+
+
+uint8_t obisRegistrySlots() {
+    return numSlots;
+}
+
+
+const OBISValueSlot* obisRegistrySlot(uint8_t slot) {
+    return &slots[slot];
+}
+
+
+uint8_t obisUnitCode(const char *unit) {
+    for (uint8_t i = 0; unit != NULL && strlen(unit) > 0 && OBISUnits[i].code != 255; i++) {
+        if (!strcmp(OBISUnits[i].name, unit))
+            return OBISUnits[i].code;
+    }
+    return 0;
+}
+
+
+const char* obisUnitName(uint8_t unit) {
+    uint8_t i;
+
+    for (i = 0; OBISUnits[i].code != 255 && OBISUnits[i].code != unit; i++);
+    return OBISUnits[i].name;
+}
@@ -0,0 +1,153 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include <esp_heap_caps.h>
+#include "profiler.h"
+#include "log.h"
+
+// last report (seqlock, only written by profiler task)
+static ProfileReport report;
+static std::atomic<uint32_t> reportSeq{0};
+
+static TaskStatus_t status[PROFILER_MAX_TASKS];
+#ifdef PROFILER_CPU
+static uint32_t lastRunTime[PROFILER_MAX_TASKS];
+static UBaseType_t lastTaskNumber[PROFILER_MAX_TASKS];
+static uint8_t lastTasks = 0;
+static uint32_t lastTotalRunTime = 0;
+
+
+// run time counter of task in previous sample
+static uint32_t lastTaskRunTime(UBaseType_t taskNumber) {
+    uint8_t i;
+
+    for (i = 0; i < lastTasks; i++) {
+        if (lastTaskNumber[i] == taskNumber)
+            return lastRunTime[i];
+    }
+    return 0;
+}
+#endif
+
+
+// sample all tasks and heap into report, static buffers so sampling
+// never allocates
+static void sampleTasks() {
+    uint32_t totalRunTime = 0, seq;
+#ifdef PROFILER_CPU
+    uint32_t elapsed;
+#endif
+    UBaseType_t numTasks, i;
+    TaskProfile *task;
+
+    numTasks = uxTaskGetSystemState(status, PROFILER_MAX_TASKS, &totalRunTime);
+    if (numTasks == 0) {
+        logWarn("Profiler failed, more than %d tasks", PROFILER_MAX_TASKS);
+        return;
+    }
+#ifdef PROFILER_CPU
+    elapsed = (totalRunTime - lastTotalRunTime) * portNUM_PROCESSORS;
+#endif
+
+    seq = reportSeq.load(std::memory_order_relaxed);
+    reportSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    report.millis = millis();
+#ifdef PROFILER_CPU
+    report.cpuValid = (totalRunTime > 0 && lastTotalRunTime > 0 && elapsed > 0);
+#endif
+    report.numTasks = numTasks;
+    for (i = 0; i < numTasks; i++) {
+        task = &report.tasks[i];
+        snprintf(task->name, sizeof(task->name), "%s", status[i].pcTaskName);
+        task->priority = status[i].uxCurrentPriority;
+        task->stackFree = status[i].usStackHighWaterMark;  // bytes on ESP32
+#ifdef PROFILER_CPU
+        task->cpu = !report.cpuValid ? 0 : (uint64_t)(status[i].ulRunTimeCounter -
+            lastTaskRunTime(status[i].xTaskNumber)) * 1000 / elapsed;
+#endif
+    }
+    report.freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    report.minFreeHeap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    report.maxBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    report.fragmentation = (report.freeHeap > 0) ? 100 - (uint64_t)report.maxBlock * 100 / report.freeHeap : 0;
+
+    reportSeq.store(seq + 2, std::memory_order_release);
+
+#ifdef PROFILER_CPU
+    for (i = 0; i < numTasks; i++) {
+        lastTaskNumber[i] = status[i].xTaskNumber;
+        lastRunTime[i] = status[i].ulRunTimeCounter;
+    }
+    lastTasks = numTasks;
+    lastTotalRunTime = totalRunTime;
+#endif
+}
+
+
+// consistent copy of last report, false if there is none yet
+bool getProfile(ProfileReport *copy) {
+    uint32_t seq;
+
+    do {
+        seq = reportSeq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+        *copy = report;
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != reportSeq.load(std::memory_order_relaxed));
+
+    return (seq > 0);
+}
+
+
+// vTask to sample tasks and heap every PROFILER_SECS, heap usage and
+// the task with least stack headroom are logged (all tasks as debug)
+static void profilerTask(void* parameter) {
+    TaskProfile *tightest;
+    uint8_t i;
+
+    while (1) {
+        sampleTasks();  // report is only written by this task
+        tightest = &report.tasks[0];
+        for (i = 0; i < report.numTasks; i++) {
+            if (report.tasks[i].stackFree < tightest->stackFree)
+                tightest = &report.tasks[i];
+#ifdef PROFILER_CPU
+            logDebug("Task %s: prio %d, %d bytes stack left, cpu %d.%d%%", report.tasks[i].name,
+                report.tasks[i].priority, report.tasks[i].stackFree,
+                report.tasks[i].cpu / 10, report.tasks[i].cpu % 10);
+#else
+            logDebug("Task %s: prio %d, %d bytes stack left", report.tasks[i].name,
+                report.tasks[i].priority, report.tasks[i].stackFree);
+#endif
+        }
+        logInfo("Heap %d free (min. %d, max. block %d, %d%% fragmented), least stack %s (%d bytes)",
+            report.freeHeap, report.minFreeHeap, report.maxBlock, report.fragmentation,
+            tightest->name, tightest->stackFree);
+        vTaskDelay((PROFILER_SECS * 1000) / portTICK_PERIOD_MS);
+    }
+}
+
+
+void startProfiler() {
+    xTaskCreate(profilerTask, "profiler", 2560, NULL, 1, NULL);
+}
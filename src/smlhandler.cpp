@@ -23,68 +23,28 @@
 #include "utils.h"
 
 
-void EnergyFromGridTotal(SMLDeviceReadings *data, const byte *obis) {
-    smlOBISWh(data->energyFromGridTotal);
+// store fixed-point value and scaler of list entry in given value slot
+// of OBIS registry and mark it as present, false if entry has no value
+bool OBISValue(SMLDeviceReadings *data, const sml_context_t *sml, uint8_t slot) {
+    if (!smlOBISValue(sml, (sml_units_t)obisRegistrySlot(slot)->unit, data->value[slot], data->scaler[slot]))
+        return false;
+    data->present |= (1UL << slot);
+    return true;
 }
 
 
-void EnergyToGridTotal(SMLDeviceReadings *data, const byte *obis) {
-    smlOBISWh(data->energyToGridTotal);
-}
-
-
-void PowerFromGridTotal(SMLDeviceReadings *data, const byte *obis) {
-    smlOBISW(data->powerFromGridTotal);
-}
-
-
-void PowerToGridTotal(SMLDeviceReadings *data, const byte *obis) {
-    smlOBISW(data->powerToGridTotal);
-}
-
-
-void PowerFromGridL1(SMLDeviceReadings *data, const byte *obis) {
-    smlOBISW(data->powerFromGridL1);
-}
+// 3 byte manufacturer signature from value of list entry
+void Manufacturer(SMLDeviceReadings *data, const sml_context_t *sml, const byte *obis) { 
+    uint8_t manufacturer[3];
 
-
-void PowerFromGridL2(SMLDeviceReadings *data, const byte *obis) {
-    smlOBISW(data->powerFromGridL2);
-}
-
-
-void PowerFromGridL3(SMLDeviceReadings *data, const byte *obis) {
-    smlOBISW(data->powerFromGridL3);
-}
-
-// parse 3 byte manufacturer signature
-void Manufacturer(SMLDeviceReadings *data, const byte *obis) { 
-    uint8_t i = 0;
-    char *pos; 
-
-    pos = (char*)memmem(data->fullMessage, data->msgSize, obis, 6);
-    while (pos != NULL && i++ < 24) {
-        if (*(pos + i) == 0x04) { // marker for list entry 3 byte signature
-            memcpy(data->manufacturer, (pos + i + 1), 3);
-            data->manufacturer[3] = '\0';
-            return;
-        }
+    if (smlOBISOctetString(sml, manufacturer, sizeof(manufacturer)) == 3) {
+        memcpy(data->manufacturer, manufacturer, 3);
+        data->manufacturer[3] = '\0';
     }
 }
 
 
-// parse serial number / server id
-void Serialnumber(SMLDeviceReadings *data, const byte *obis) {
-    uint8_t i = 0;
-    char *pos;
-    char serialnumber[10];
-
-    pos = (char*)memmem(data->fullMessage, data->msgSize, obis, 6);
-    while (pos != NULL && i++ < 24) {
-        if (*(pos + i) == 0x0B) { // 0x0B marks list entry with 10 bytes
-            memcpy(serialnumber, (pos + i + 1), 10);
-            arr2str(serialnumber, sizeof(serialnumber), data->serialnumber);
-            return;
-        }
-    }
+// serial number / server id (10 bytes) from value of list entry
+void Serialnumber(SMLDeviceReadings *data, const sml_context_t *sml, const byte *obis) {
+    data->serverIdLen = smlOBISOctetString(sml, data->serverId, sizeof(data->serverId));
 }
\ No newline at end of file
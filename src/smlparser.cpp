@@ -20,114 +20,394 @@
 
 #include "smlparser.h"
 #include "smlhandler.h"
-#include "rtc.h"
 #include "utils.h"
+#include "log.h"
 #include "config.h"
 
-sml_states_t currentState;
-
-OBISHandler OBISHandlers[] = {
+constexpr OBISHandler OBISHandlers[] = {
     { { 0x81, 0x81, 0xc7, 0x82, 0x03, 0xff }, &Manufacturer },         /* 129-129:199.130.3*255 */
     { { 0x01, 0x00, 0x60, 0x32, 0x01, 0x01 }, &Manufacturer },         /* 1-0:96.50.1*1 */
-    { { 0x01, 0x00, 0x01, 0x08, 0x00, 0xff }, &EnergyFromGridTotal },  /* 1-0:1.8.0*255 (Total Power From Grid T1+T2) */
-    { { 0x01, 0x00, 0x02, 0x08, 0x00, 0xff }, &EnergyToGridTotal },    /* 1-0:2.8.0*255 (Total Power To Grid T1+T2) */    
-    { { 0x01, 0x00, 0x10, 0x07, 0x00, 0xff }, &PowerFromGridTotal },   /* 1-0:16.7.0*255 (Active Power from Grid) */
-    { { 0x01, 0x00, 0x0F, 0x07, 0x00, 0xff }, &PowerToGridTotal },     /* 1-0:15.7.0*255 (Active Power to Grid) */
-    { { 0x01, 0x00, 0x24, 0x07, 0x00, 0xff }, &PowerFromGridL1 },      /* 1-0:36.7.0*255 (Active Power L1) */
-    { { 0x01, 0x00, 0x38, 0x07, 0x00, 0xff }, &PowerFromGridL2 },      /* 1-0:56.7.0*255 (Active Power L2) */
-    { { 0x01, 0x00, 0x4C, 0x07, 0x00, 0xff }, &PowerFromGridL3 },      /* 1-0:76.7.0*255 (Active Power L3) */
-    { { 0x01, 0x00, 0x15, 0x07, 0x00, 0xff }, &PowerFromGridL1 },      /* 1-0:21.7.0*255 (Active Power L1) */
-    { { 0x01, 0x00, 0x29, 0x07, 0x00, 0xff }, &PowerFromGridL2 },      /* 1-0:41.7.0*255 (Active Power L2) */
-    { { 0x01, 0x00, 0x3D, 0x07, 0x00, 0xff }, &PowerFromGridL3 },      /* 1-0:61.7.0*255 (Active Power L3) */
     { { 0x01, 0x00, 0x60, 0x01, 0x00, 0xff }, &Serialnumber },         /* 1-0:96.1.0*255 */
     { { 0x01, 0x00, 0x00, 0x00, 0x09, 0xff }, &Serialnumber },         /* 1-0:0.0.9*255 */
-    { { 0 }, 0}
 };
 
+#define OBIS_HANDLERS (sizeof(OBISHandlers) / sizeof(OBISHandlers[0]))
+
+// OBISHandlers[] is turned into a perfect hash table at compile time, so
+// every list entry is dispatched with a single lookup; if static_assert()
+// below reports a collision after adding a handler, try another multiplier
+#define OBIS_HASH_BITS 5
+#define OBIS_HASH_SLOTS (1 << OBIS_HASH_BITS)
+#define OBIS_HASH_MULT 0x9E3779E5
+
+static constexpr uint64_t obisKey(const byte *obis) {
+    return ((uint64_t)obis[0] << 40) | ((uint64_t)obis[1] << 32) | ((uint64_t)obis[2] << 24) |
+        ((uint64_t)obis[3] << 16) | ((uint64_t)obis[4] << 8) | obis[5];
+}
+
+static constexpr uint8_t obisHash(uint64_t key) {
+    return ((uint32_t)(key ^ (key >> 32)) * (uint32_t)OBIS_HASH_MULT) >> (32 - OBIS_HASH_BITS);
+}
+
+// index of handler for given slot or OBIS_HANDLERS if slot is empty
+static constexpr uint8_t obisEntry(uint8_t slot, uint8_t i = 0) {
+    return (i >= OBIS_HANDLERS) ? OBIS_HANDLERS :
+        (obisHash(obisKey(OBISHandlers[i].OBIS)) == slot) ? i : obisEntry(slot, i + 1);
+}
+
+static constexpr uint8_t obisCollisions(uint8_t i = 0, uint8_t j = 1) {
+    return (i >= OBIS_HANDLERS) ? 0 : (j >= OBIS_HANDLERS) ? obisCollisions(i + 1, i + 2) :
+        (obisHash(obisKey(OBISHandlers[i].OBIS)) == obisHash(obisKey(OBISHandlers[j].OBIS))) +
+        obisCollisions(i, j + 1);
+}
+
+static_assert(OBIS_HANDLERS < OBIS_HASH_SLOTS, "too many OBIS handlers for hash table");
+static_assert(obisCollisions() == 0, "OBIS hash collision, change OBIS_HASH_MULT");
+
+typedef struct {
+    uint64_t key;
+    void (*Handler)(SMLDeviceReadings *data, const sml_context_t *sml, const byte *obis);
+    const byte *OBIS;
+} OBISSlot;
+
+static constexpr OBISSlot obisSlot(uint8_t slot) {
+    return (obisEntry(slot) >= OBIS_HANDLERS) ? OBISSlot{ 0, NULL, NULL } :
+        OBISSlot{ obisKey(OBISHandlers[obisEntry(slot)].OBIS), OBISHandlers[obisEntry(slot)].Handler,
+            OBISHandlers[obisEntry(slot)].OBIS };
+}
+
+#define OBIS_SLOTS_4(n) obisSlot(n), obisSlot(n+1), obisSlot(n+2), obisSlot(n+3)
+#define OBIS_SLOTS_16(n) OBIS_SLOTS_4(n), OBIS_SLOTS_4(n+4), OBIS_SLOTS_4(n+8), OBIS_SLOTS_4(n+12)
+
+static constexpr OBISSlot OBISTable[OBIS_HASH_SLOTS] = { OBIS_SLOTS_16(0), OBIS_SLOTS_16(16) };
+
+
+void resetSMLParser(SMLParserContext *ctx) {
+    smlInit(&ctx->sml);
+    ctx->frameCounter = 0;
+    ctx->unexpectedBytes = 0;
+    ctx->resync = false;
+    ctx->resyncMatch = 0;
+#ifdef SML_RAW_COPY
+    ctx->rawMessage = NULL;
+    ctx->rawCapacity = 0;
+#endif
+#ifdef SML_FRAME_TEMPLATE
+    ctx->lastMessage = NULL;
+    ctx->lastSize = 0;
+    ctx->entryOffset = 0;
+    ctx->layout = 0;
+    ctx->lastLayout = 0;
+    ctx->templateNext = false;
+    ctx->templateFrame = false;
+    ctx->templateStart = 0;
+    memset(ctx->learned, 0, sizeof(ctx->learned));
+    ctx->tmpl.size = 0;
+    ctx->tmpl.layout = 0;
+    ctx->tmpl.frames = 0;
+#endif
+}
+
 
 void resetSMLReadings(SMLDeviceReadings *data) {
     memset(data->manufacturer, 0, sizeof(data->manufacturer));
-    memset(data->serialnumber, 0, sizeof(data->serialnumber));
-    memset(data->fullMessage, 0, sizeof(data->fullMessage));
-    data->energyFromGridTotal = LONG_MIN;
-    data->energyToGridTotal = LONG_MIN;
-    data->powerFromGridTotal = LONG_MIN;
-    data->powerToGridTotal = LONG_MIN;
-    data->powerFromGridL1 = LONG_MIN;
-    data->powerFromGridL2 = LONG_MIN;
-    data->powerFromGridL3 = LONG_MIN;
+    data->serverIdLen = 0;
+    data->present = 0;
     data->timestamp = 0;
     data->state = SML_VERSION;
 }
 
 
-bool readSMLByte(byte c, SMLDeviceReadings *data) {
-    static uint32_t lastErrMsgMillis = 0;
-    static uint16_t frameCounter = 0;
+#ifdef SML_FRAME_TEMPLATE
+// integer of given size and type at given offset of raw message, decoded
+// just like smlOBISValue() does with the list buffer
+static int64_t templateInt(const char *raw, uint16_t offset, uint8_t size, uint8_t type) {
+    uint64_t val = 0;
+
+    for (uint8_t i = 0; i < size; i++)
+        val = (val << 8) | (uint8_t)raw[offset + i];
+    if (type == SML_DATA_SIGNED_INT && size < 8 && (raw[offset] & 0x80))
+        val |= ~(uint64_t)0 << (size * 8);
+    return (int64_t)val;
+}
+
+
+// offsets of scaler and value of current list entry in message (walks
+// the list buffer like smlOBISValue()), only kept for the template if
+// the raw message holds the value just decoded at these offsets
+static void learnTemplateValue(SMLParserContext *ctx, const SMLDeviceReadings *data, uint8_t slot) {
+    const uint8_t *list = ctx->sml.listBuffer;
+    uint16_t offset = ctx->entryOffset + 1;  // after type-length field of list entry
+    uint8_t i = 0, pos = 0, size, type, skip;
+    SMLTemplateValue entry = { 0, 0, 0, 0 };
+
+    while (i < ctx->sml.listPos && pos < 6) {
+        pos++;
+        size = list[i++];
+        type = list[i++];
+        offset++;  // type-length field
+        if (type == SML_LISTSTART && size > 0) { // skip list inside list entry
+            for (skip = size; skip > 0 && i < ctx->sml.listPos; skip--) {
+                offset += 1 + list[i];
+                i += 2 + list[i];
+            }
+            size = 0;
+        }
+        if (pos == 5 && size == 1)
+            entry.scalerOffset = offset;
+        if (pos == 6) {
+            entry.valueOffset = offset;
+            entry.valueSize = size;
+            entry.valueType = type;
+        }
+        i += size;
+        offset += size;
+    }
+
+    if (entry.valueOffset == 0 || entry.valueSize == 0 || entry.valueSize > 8 ||
+            entry.valueOffset + entry.valueSize > ctx->rawCapacity)
+        return;
+    if (templateInt(ctx->rawMessage, entry.valueOffset, entry.valueSize, entry.valueType) != data->value[slot])
+        return;
+    if ((entry.scalerOffset ? (int8_t)ctx->rawMessage[entry.scalerOffset] : 0) != data->scaler[slot])
+        return;
+    ctx->learned[slot] = entry;
+}
+
+
+// update template with message parsed completely, bytes which differ from
+// the last message with the same structure (parser states and OBIS codes)
+// are marked as changing; a new layout (structure or value offsets) is
+// learned from scratch
+static void learnTemplate(SMLParserContext *ctx, uint16_t size) {
+    SMLFrameTemplate *tmpl = &ctx->tmpl;
+    const SMLTemplateValue *value;
+    uint16_t i;
+    uint8_t slot;
+
+    if (size > ctx->rawCapacity || ctx->lastMessage == NULL || ctx->lastSize != size ||
+            ctx->lastLayout != ctx->layout) {
+        ctx->lastLayout = ctx->layout;
+        tmpl->frames = 0;
+        return;
+    }
+
+    if (tmpl->size != size || tmpl->layout != ctx->layout ||
+            memcmp(tmpl->values, ctx->learned, sizeof(tmpl->values)) != 0) {
+        tmpl->size = size;
+        tmpl->layout = ctx->layout;
+        tmpl->frames = 0;
+        memcpy(tmpl->values, ctx->learned, sizeof(tmpl->values));
+        memset(tmpl->variable, 0, sizeof(tmpl->variable));
+        for (slot = 0; slot < OBIS_REGISTRY_SLOTS; slot++) {
+            value = &tmpl->values[slot];
+            for (i = value->valueOffset; i < value->valueOffset + value->valueSize; i++)
+                tmpl->variable[i >> 3] |= (1 << (i & 7));
+            if (value->scalerOffset > 0)
+                tmpl->variable[value->scalerOffset >> 3] |= (1 << (value->scalerOffset & 7));
+        }
+        for (i = size - 2; i < size; i++)  // checksum
+            tmpl->variable[i >> 3] |= (1 << (i & 7));
+        return;  // differences to a message with another layout don't count
+    }
+
+    for (i = 0; i < size; i++) {
+        if (ctx->rawMessage[i] != ctx->lastMessage[i])
+            tmpl->variable[i >> 3] |= (1 << (i & 7));
+    }
+    if (tmpl->frames < SML_TEMPLATE_FRAMES)
+        tmpl->frames++;
+}
+
+
+// read byte of a message with the learned template: bytes which never
+// changed must match the last message, values are taken from their
+// offsets once the checksum is verified; the message is handed over to
+// the state machine on the first difference
+static bool readTemplateByte(byte c, SMLParserContext *ctx, SMLDeviceReadings *data) {
+    const SMLFrameTemplate *tmpl = &ctx->tmpl;
+    const SMLTemplateValue *value;
+    const uint8_t *raw = (const uint8_t*)ctx->rawMessage;
+    uint16_t pos = ctx->frameCounter, i;
     time_t time_utc;
-    uint8_t iHandler = 0;
-    char* msg;
-    
-    currentState = smlState(c);
-    if (frameCounter != 0 && currentState == SML_START) {
+    uint8_t slot;
+
+    // the state machine keeps only the last two bytes of the start
+    // sequence, so the first two are just counted
+    if (pos == 0 && c == 0x1B && ++ctx->templateStart < 3)
+        return false;
+
+    if (pos >= tmpl->size || (c != (byte)ctx->lastMessage[pos] &&
+            !(tmpl->variable[pos >> 3] & (1 << (pos & 7))))) {
+        // state machine is still where the last message left it
+        ctx->templateFrame = false;
+        ctx->frameCounter = 0;
+        if (pos == 0) {  // replay message so far
+            for (i = 0; i < ctx->templateStart; i++)
+                readSMLByte(0x1B, ctx, data);
+        } else {
+            for (i = 0; i < 2; i++)
+                readSMLByte(0x1B, ctx, data);
+            for (i = 0; i < pos; i++)
+                readSMLByte(raw[i], ctx, data);
+        }
+        return readSMLByte(c, ctx, data);
+    }
+
+    ctx->rawMessage[pos] = c;
+    data->msgSize = ++ctx->frameCounter;
+    if (ctx->frameCounter < tmpl->size)
+        return false;
+
+    ctx->templateFrame = false;
+    ctx->frameCounter = 0;
+    time(&time_utc);
+    data->timestamp = time_utc;
+    if (smlMessageCRC(raw + 2, tmpl->size - 4) != (raw[tmpl->size - 2] | (raw[tmpl->size - 1] << 8))) {
+        logWarnAt(&ctx->logSites[SML_LOG_CHECKSUM],
+            "Received SML message with invalid checksum on pin %d (%d bytes)",
+            data->pin, tmpl->size);
+        data->state = SML_CHECKSUM_ERROR;
+        return true;
+    }
+    for (slot = 0; slot < OBIS_REGISTRY_SLOTS; slot++) {
+        value = &tmpl->values[slot];
+        if (value->valueOffset == 0)
+            continue;
+        data->value[slot] = templateInt(ctx->rawMessage, value->valueOffset, value->valueSize, value->valueType);
+        data->scaler[slot] = value->scalerOffset ? (int8_t)raw[value->scalerOffset] : 0;
+        data->present |= (1UL << slot);
+    }
+    logInfo("Received and parsed SML message on pin %d (%d bytes)", data->pin, tmpl->size);
+    data->state = SML_FINAL;
+    ctx->lastLayout = tmpl->layout;
+    ctx->templateNext = true;
+    return true;
+}
+#endif
+
+
+// feed byte received on reading head into its own parser context
+bool readSMLByte(byte c, SMLParserContext *ctx, SMLDeviceReadings *data) {
+    sml_states_t currentState;
+    time_t time_utc;
+    const OBISSlot *slot;
+    int8_t value;
+    uint64_t key;
+#ifdef SML_FRAME_TEMPLATE
+    sml_states_t previousState;
+
+    if (ctx->templateNext && ctx->frameCounter == 0) {
+        ctx->templateNext = false;
+        ctx->templateFrame = (ctx->tmpl.frames >= SML_TEMPLATE_FRAMES && ctx->lastMessage != NULL &&
+            ctx->lastSize == ctx->tmpl.size && ctx->rawCapacity >= ctx->tmpl.size);
+        ctx->templateStart = 0;
+        if (ctx->templateFrame) {
+            // values of the last message must not survive a checksum error
+            // or a fallback, manufacturer and server id are part of template
+            data->present = 0;
+            data->state = SML_VERSION;
+        }
+    }
+    if (ctx->templateFrame)
+        return readTemplateByte(c, ctx, data);
+#endif
+
+#ifdef SML_FRAME_TEMPLATE
+    previousState = ctx->sml.state;
+#endif
+    currentState = smlState(&ctx->sml, c);
+    if (ctx->frameCounter != 0 && currentState == SML_START) {
         resetSMLReadings(data);
-        frameCounter = 0;
+        ctx->frameCounter = 0;
     }
 
-    // copy of full message used to parse serial number and manufacturer
-    if (frameCounter < sizeof(data->fullMessage)) {
-        data->fullMessage[frameCounter++] = c;
-        data->msgSize = frameCounter;
+#ifdef SML_FRAME_TEMPLATE
+    if (ctx->frameCounter == 0) {
+        memset(ctx->learned, 0, sizeof(ctx->learned));
+        ctx->layout = 0;
     }
+    // only data and checksum bytes may differ between messages with the
+    // same layout, type-length fields are hashed with their value
+    ctx->layout = ctx->layout * 31 + currentState;
+    if (previousState != SML_DATA && previousState != SML_DATA_SIGNED_INT && previousState != SML_CHECKSUM &&
+            previousState != SML_DATA_UNSIGNED_INT && previousState != SML_DATA_OCTET_STRING)
+        ctx->layout = ctx->layout * 31 + c;
+    if (currentState == SML_LISTSTART && ctx->sml.listPos == 0)  // new list entry
+        ctx->entryOffset = ctx->frameCounter;
+#endif
+
+#ifdef SML_RAW_COPY
+    // raw copy of message is only kept for debugging and capturing,
+    // all values are decoded from the list entries while they stream past
+    if (ctx->frameCounter < ctx->rawCapacity)
+        ctx->rawMessage[ctx->frameCounter] = c;
+#endif
+    data->msgSize = ++ctx->frameCounter;
 
     if (currentState == SML_LISTEND) {
-        for (iHandler = 0; OBISHandlers[iHandler].Handler != 0 &&
-                !(smlOBISCheck(OBISHandlers[iHandler].OBIS)); iHandler++);
-        if (OBISHandlers[iHandler].Handler != 0) {
-            OBISHandlers[iHandler].Handler(data, OBISHandlers[iHandler].OBIS);
+        key = smlOBISKey(&ctx->sml);
+#ifdef SML_FRAME_TEMPLATE
+        ctx->layout = ctx->layout * 31 + (uint32_t)(key ^ (key >> 32));  // OBIS codes never change
+#endif
+        slot = &OBISTable[obisHash(key)];
+        if (slot->Handler != NULL && slot->key == key)
+            slot->Handler(data, &ctx->sml, slot->OBIS);
+        else if ((value = obisRegistryLookup(key)) >= 0) {  // generic value slot
+#ifdef SML_FRAME_TEMPLATE
+            if (OBISValue(data, &ctx->sml, value))
+                learnTemplateValue(ctx, data, value);
+#else
+            OBISValue(data, &ctx->sml, value);
+#endif
         }
     }
 
-    if (frameCounter >= sizeof(data->fullMessage)) {
-        xSemaphoreTake(SerialLock, portMAX_DELAY);
-        Serial.printf("%ld: SML buffer exceeded (%d bytes)\n", millis(), frameCounter);
-        xSemaphoreGive(SerialLock); 
+    if (ctx->frameCounter >= SML_MAX_MSG_SIZE) {
+        logWarnAt(&ctx->logSites[SML_LOG_OVERFLOW], "SML buffer exceeded on pin %d (%d bytes)",
+            data->pin, ctx->frameCounter);
         time(&time_utc);
         data->timestamp = time_utc;
         data->state = SML_END;
-        frameCounter = 0;
+        smlInit(&ctx->sml);  // resync on next start sequence
+        ctx->frameCounter = 0;
         return true;
     }
 
     if (currentState == SML_UNEXPECTED) {
-        if (millis() - lastErrMsgMillis > 1000) {
-            xSemaphoreTake(SerialLock, portMAX_DELAY);
-            Serial.printf("%ld: Received unexpected byte\n", millis());
-            xSemaphoreGive(SerialLock); 
-            lastErrMsgMillis = millis();
-        }
+        ctx->unexpectedBytes++;
+        if (!ctx->resync)  // log once until next message
+            logWarnAt(&ctx->logSites[SML_LOG_UNEXPECTED],
+                "Received unexpected byte on pin %d, waiting for next message", data->pin);
+        ctx->resync = true;
+        ctx->resyncMatch = (c == 0x1B) ? 1 : 0;  // might start next message
+#ifdef SML_FRAME_TEMPLATE
+        ctx->templateNext = false;
+#endif
     }
 
-    if (frameCounter != 0 && currentState == SML_CHECKSUM_ERROR) {
-        xSemaphoreTake(SerialLock, portMAX_DELAY);
-        Serial.printf("%ld: Received SML message with invalid checksum on pin %d (%d bytes)\n", 
-            millis(), data->pin, frameCounter);
-        xSemaphoreGive(SerialLock); 
+    if (ctx->frameCounter != 0 && currentState == SML_CHECKSUM_ERROR) {
+        logWarnAt(&ctx->logSites[SML_LOG_CHECKSUM],
+            "Received SML message with invalid checksum on pin %d (%d bytes)",
+            data->pin, ctx->frameCounter);
         time(&time_utc);
         data->timestamp = time_utc;
         data->state = SML_CHECKSUM_ERROR;
-        frameCounter = 0;
+        ctx->frameCounter = 0;
+        ctx->resync = false;
         return true;
 
-    } else if (frameCounter != 0 && currentState == SML_FINAL) {
-        xSemaphoreTake(SerialLock, portMAX_DELAY);
-        Serial.printf("%ld: Received and parsed SML message on pin %d (%d bytes)\n", 
-            millis(), data->pin, frameCounter);
-        xSemaphoreGive(SerialLock); 
+    } else if (ctx->frameCounter != 0 && currentState == SML_FINAL) {
+        logInfo("Received and parsed SML message on pin %d (%d bytes)", data->pin, ctx->frameCounter);
         time(&time_utc);
         data->timestamp = time_utc;
         data->state = SML_FINAL;
-        frameCounter = 0;
+#ifdef SML_FRAME_TEMPLATE
+        learnTemplate(ctx, ctx->frameCounter);
+        ctx->templateNext = true;
+#endif
+        ctx->frameCounter = 0;
+        ctx->resync = false;
         return true;
     }
 
@@ -135,11 +415,126 @@ bool readSMLByte(byte c, SMLDeviceReadings *data) {
 }
 
 
-void printSMLReadings(const SMLDeviceReadings &data) {
-    char buf[16], timeStr[24];
+// skip bytes after lost sync until the start sequence of the next message
+// (1B1B1B1B 01010101), a word at a time as long as it holds no escape byte;
+// the start sequence is fed into the state machine once it is complete,
+// returns number of bytes consumed
+uint16_t scanSMLStart(const byte *buf, uint16_t len, SMLParserContext *ctx, SMLDeviceReadings *data) {
+    static const byte start[8] = { 0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01 };
+    uint16_t i = 0;
+    uint32_t word;
+    byte c;
+
+    while (i < len && ctx->resyncMatch < sizeof(start)) {
+        if (ctx->resyncMatch == 0) {
+            for (; i + 4 <= len; i += 4) {
+                memcpy(&word, buf + i, 4);
+                word ^= 0x1B1B1B1B;  // escape bytes become zero bytes
+                if ((word - 0x01010101) & ~word & 0x80808080)
+                    break;
+            }
+            if (i >= len)
+                break;
+        }
+        c = buf[i++];
+        if (c == start[ctx->resyncMatch])
+            ctx->resyncMatch++;
+        else if (c == 0x1B)  // more than four escape bytes or new start
+            ctx->resyncMatch = (ctx->resyncMatch == 4) ? 4 : 1;
+        else
+            ctx->resyncMatch = 0;
+    }
+    ctx->unexpectedBytes += i;
+
+    if (ctx->resyncMatch == sizeof(start)) {
+        logInfo("Found start of next SML message on pin %d", data->pin);
+        ctx->unexpectedBytes -= sizeof(start);
+        ctx->resync = false;
+        ctx->resyncMatch = 0;
+        smlInit(&ctx->sml);
+        ctx->frameCounter = 0;
+        for (uint8_t j = 0; j < sizeof(start); j++)
+            readSMLByte(start[j], ctx, data);
+    }
+    return i;
+}
+
+
+// abandon incomplete message, e.g. after an idle gap on the line which
+// can only be the pause between two messages; false if none in progress
+bool abortSMLMessage(SMLParserContext *ctx) {
+    if (ctx->frameCounter == 0 || ctx->resync)
+        return false;
+    smlInit(&ctx->sml);
+    ctx->frameCounter = 0;
+    ctx->resync = true;
+    ctx->resyncMatch = 0;
+#ifdef SML_FRAME_TEMPLATE
+    ctx->templateNext = false;
+    ctx->templateFrame = false;
+#endif
+    return true;
+}
+
+
+// check if value slot was found in last message
+bool smlHasValue(const SMLDeviceReadings &data, uint8_t slot) {
+    return (data.present & (1UL << slot));
+}
+
+
+// fixed-point value as floating-point number in unit of value slot
+// (e.g. value in Wh published as kWh)
+double smlValue(const SMLDeviceReadings &data, uint8_t slot) {
+    double val = data.value[slot];
+    int8_t scaler = data.scaler[slot] - obisRegistrySlot(slot)->scale;
+
+    for (; scaler < 0; scaler++)
+        val /= 10;
+    for (; scaler > 0; scaler--)
+        val *= 10;
+    return val;
+}
+
+
+// number of decimal places of value in unit of value slot
+uint8_t smlValueDecimals(const SMLDeviceReadings &data, uint8_t slot) {
+    int8_t decimals = obisRegistrySlot(slot)->scale - data.scaler[slot];
+
+    return (decimals > 0) ? decimals : 0;
+}
+
+
+// serial number (server id) as hex string, needs 21 bytes
+char* smlSerialnumber(const SMLDeviceReadings &data, char *buf) {
+    if (data.serverIdLen == 0) {
+        memset(buf, '0', 20);
+        buf[20] = '\0';
+    } else {
+        arr2str((char*)data.serverId, data.serverIdLen, buf);
+        buf[data.serverIdLen * 2] = '\0';
+    }
+    return buf;
+}
+
+
+// SI prefix for unit of value slot with given scale
+static const char* unitPrefix(int8_t scale) {
+    switch (scale) {
+        case -3: return "m";
+        case 3: return "k";
+        case 6: return "M";
+        default: return "";
+    }
+}
+
+
+void printSMLReadings(const SMLDeviceReadings &data, const char *raw, uint16_t rawSize) {
+    char buf[24], timeStr[24];
+    uint8_t slot;
 #ifdef DEBUG_SML
     uint16_t i = 0, j = 2;
-    static char smlmsg[1024];
+    static char smlmsg[SML_MAX_MSG_SIZE * 2 + 1];
 #endif
     time_t time_utc;
     struct tm tm;
@@ -154,28 +549,18 @@ void printSMLReadings(const SMLDeviceReadings &data) {
             tm.tm_hour, tm.tm_min, tm.tm_sec);
         Serial.printf("  Timestamp: %s\n", timeStr);
         Serial.printf("  Manufacturer: %s\n", data.manufacturer);
-        Serial.printf("  Serialnumber: %s\n", data.serialnumber);
-        if (data.energyFromGridTotal > LONG_MIN) {
-            dtostrf(data.energyFromGridTotal/1000, 12, 3, buf);
-            Serial.printf("  Total Consumption: %s kWh\n", removeSpaces(buf));
-        }
-        if (data.energyToGridTotal > LONG_MIN) {
-            dtostrf(data.energyToGridTotal/1000, 12, 3, buf);
-            Serial.printf("  Total Feed to Grid: %s kWh\n", removeSpaces(buf));
+        Serial.printf("  Serialnumber: %s\n", smlSerialnumber(data, buf));
+        for (slot = 0; slot < obisRegistrySlots(); slot++) {
+            if (!smlHasValue(data, slot))
+                continue;
+            dtostrf(smlValue(data, slot), 12, smlValueDecimals(data, slot), buf);
+            Serial.printf("  %s: %s %s%s\n", obisRegistrySlot(slot)->label, removeSpaces(buf),
+                unitPrefix(obisRegistrySlot(slot)->scale), obisUnitName(obisRegistrySlot(slot)->unit));
         }
-        if (data.powerFromGridTotal > LONG_MIN)
-            Serial.printf("  Total Active Power: %d W\n", int(data.powerFromGridTotal));        
-        if (data.powerFromGridL1 > LONG_MIN)
-            Serial.printf("  Active Power L1: %d W\n", int(data.powerFromGridL1));
-        if (data.powerFromGridL2 > LONG_MIN)
-            Serial.printf("  Active Power L2: %d W\n", int(data.powerFromGridL2));
-        if (data.powerFromGridL3 > LONG_MIN)
-            Serial.printf("  Active Power L3: %d W\n", int(data.powerFromGridL3));
-        if (data.powerToGridTotal > LONG_MIN)
-            Serial.printf("  Total Active Power to Grid: %d W\n", int(data.powerToGridTotal));
 #ifdef DEBUG_SML
         memset(smlmsg, 0, sizeof(smlmsg));
-        arr2str(data.fullMessage, data.msgSize, smlmsg);
+        if (raw != NULL)
+            arr2str(raw, rawSize, smlmsg);
         Serial.print(F("  Raw SML message:\n    1B"));
         while (i < strlen(smlmsg)) {
             Serial.print(smlmsg[i++]);
@@ -18,10 +18,11 @@
 
 ***************************************************************************/
 
+#include <utility>
 #include "smlreader.h"
 #include "smlparser.h"
 #include "utils.h"
-#include "testdata.h"
+#include "log.h"
 #include "config.h"
 
 
@@ -29,94 +30,430 @@ std::list<SMLReader *> *smlreaderList = new std::list<SMLReader *>();
 
 
 SMLReader::SMLReader(const uint8_t pin) {
+    resetSMLReadings(&this->current);
+    resetSMLReadings(&this->readings);
     this->begin(pin);
+}
+
+
+// reader with given source of SML data, e.g. for testing on host
+SMLReader::SMLReader(const uint8_t pin, ByteSource *source) {
+    resetSMLReadings(&this->current);
     resetSMLReadings(&this->readings);
+    this->begin(pin, source);
+}
+
+
+#ifdef SML_RAW_COPY
+SMLReader::~SMLReader() {
+    this->releaseFrameBuffers();
 }
+#endif
 
 
 bool SMLReader::begin(const uint8_t pin) {
+#ifdef DEBUG_TESTDATA
+    static uint8_t count = 0;  // every reader starts with another message
+    return this->begin(pin, new ReplaySource(SML_TESTDATA_BAUD, count++));
+#else
     if (pin >= 0 && pin <= 36) {  // ESP32
-        this->readings.pin = pin;
-        this->ss = std::unique_ptr<SoftwareSerial>(new SoftwareSerial());
-        this->ss->begin(9600, SWSERIAL_8N1, this->readings.pin, -1, false, SML_MSG_BUFFER);
-        this->ss->enableTx(false);
-        this->ss->enableRx(true);
-        return true;
+        return this->begin(pin, new SoftwareSerialSource(pin, SML_RX_BUFFER));
     } else {
         Serial.println(F("SMLReader(): invalid pin number!"));
         return false;
     }
+#endif
+}
+
+
+// reader takes ownership of given source
+bool SMLReader::begin(const uint8_t pin, ByteSource *source) {
+    memset(&this->stats, 0, sizeof(this->stats));
+    this->stats.pin = pin;
+    this->rateMillis = millis();
+    this->lastByteMillis = this->rateMillis;
+    this->pin = pin;
+    this->readings.pin = pin;
+    this->current.pin = pin;
+#ifdef SML_RAW_COPY
+    this->releaseFrameBuffers();  // borrowed again after first message
+    resetSMLParser(&this->parser);
+#else
+    resetSMLParser(&this->parser);
+#endif
+    this->parser.resync = true;  // skip to first complete message
+#ifdef SML_CAPTURE_BYTES
+    resetCapture(&this->capture);
+#endif
+#ifdef SML_AGGREGATE_WINDOWS
+    resetAggregates(&this->aggregates);
+    memset(this->aggregatesTaken, 0, sizeof(this->aggregatesTaken));
+#endif
+    this->source = std::unique_ptr<ByteSource>(source);
+    this->source->onReceive(rxHandler, this);
+    return true;
+}
+
+
+void SMLReader::rxHandler(void* _this) {
+    static_cast<SMLReader*>(_this)->notifyReader();
+}
+
+
+// wake up reader task on incoming data, might be called from ISR
+void SMLReader::notifyReader() {
+    this->rxPending = true;
+#ifndef SML_NATIVE
+    BaseType_t wakeup = pdFALSE;
+
+    if (this->readerTask == NULL)
+        return;
+    if (xPortInIsrContext()) {
+        vTaskNotifyGiveFromISR(this->readerTask, &wakeup);
+        if (wakeup)
+            portYIELD_FROM_ISR();
+    } else {
+        xTaskNotifyGive(this->readerTask);
+    }
+#endif
 }
 
-#ifndef DEBUG_TESTDATA
-void SMLReader::read() {
-    while (this->ss->available()) {
-        if (readSMLByte(this->ss->read(), &readings)) {
-            this->ss->flush();
-            return;
+
+// parse bytes received so far (at most 'budget'), completed messages are
+// handed over immediately; returns true if more data is waiting
+bool SMLReader::read(uint16_t budget) {
+    uint32_t start = micros(), now, bytes = 0;
+    byte buf[SML_READ_CHUNK];
+    int len, i;
+
+    while (budget > 0 && (len = this->source->read(buf, (budget < sizeof(buf)) ? budget : sizeof(buf))) > 0) {
+        budget -= len;
+        bytes += len;
+        for (i = 0; i < len; ) {
+            if (this->parser.resync) {  // line noise or started mid-message
+                i += scanSMLStart(buf + i, len - i, &this->parser, &this->current);
+            } else if (readSMLByte(buf[i++], &this->parser, &this->current)) {
+                now = micros();
+                this->countFrame(this->frameMicros + (now - start));
+                this->frameMicros = 0;
+                start = now;
+                this->publishReadings();
+            }
         }
     }
+    this->frameMicros += micros() - start;
+
+    now = millis();
+    if (bytes > 0) {
+        this->lastByteMillis = now;
+    } else if ((now - this->lastByteMillis) >= SML_FRAME_GAP_MS && abortSMLMessage(&this->parser)) {
+        logWarnAt(&this->parser.logSites[SML_LOG_ABANDONED],
+            "Abandoned incomplete SML message on pin %d after %d ms without data",
+            this->pin, now - this->lastByteMillis);
+        this->stats.aborted++;
+        this->frameMicros = 0;
+    }
+#ifdef SML_AGGREGATE_WINDOWS
+    if (bytes == 0)  // periodic wakeup without data
+        this->closeAggregates();
+#endif
+
+    this->stats.bytes += bytes;
+    this->rateBytes += bytes;
+    if ((now - this->rateMillis) >= SML_RATE_WINDOW_MS) {
+        this->stats.bytesPerSec = (uint64_t)this->rateBytes * 1000 / (now - this->rateMillis);
+        this->rateBytes = 0;
+        this->rateMillis = now;
+    }
+    return (this->source->available() > 0);
 }
 
-#else
-// feed data from testdata.h
-void SMLReader::read() {
-    static uint8_t count = 0;
-    static uint8_t* data;
-
-    if (count >= sizeof(SML_TESTDATA_SIZE)/2)
-        count = 0;
-    data = SML_TESTDATA[count];
-
-    for (uint16_t i = 0; i < SML_TESTDATA_SIZE[count]; i++) {
-        if (readSMLByte(*data, &readings)) {
-            count++;
-            return;
+
+// update counters with completed message which took given time to parse
+void SMLReader::countFrame(uint32_t parseMicros) {
+    uint16_t bucket = this->current.msgSize / SML_FRAME_SIZE_STEP;
+
+    if (this->current.state == SML_CHECKSUM_ERROR) {
+        this->stats.checksumErrors++;
+    } else if (this->current.state == SML_END) {
+        this->stats.overflows++;
+    } else {
+        this->stats.frames++;
+        this->stats.lastFrameMillis = millis();
+        this->stats.frameSizes[bucket < SML_FRAME_SIZE_BUCKETS ? bucket : SML_FRAME_SIZE_BUCKETS - 1]++;
+    }
+    this->stats.parseMicros += parseMicros;
+    if (parseMicros > this->stats.maxParseMicros)
+        this->stats.maxParseMicros = parseMicros;
+}
+
+
+// copy of counters, fields are updated by the reader task without locking
+SMLReaderStats SMLReader::getStats() {
+    SMLReaderStats stats;
+
+    memcpy(&stats, (const void*)&this->stats, sizeof(stats));
+    stats.unexpectedBytes = this->parser.unexpectedBytes;
+    return stats;
+}
+
+
+// hand over completed message to consumers (seqlock writer side), the
+// sequence number is odd while the snapshot is being updated
+void SMLReader::publishReadings() {
+    uint32_t seq = this->seq.load(std::memory_order_relaxed);
+
+    this->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    this->readings = this->current;
+#ifdef SML_RAW_COPY
+    // parser continues with the buffer of the previous snapshot
+    std::swap(this->rawMessage, this->parser.rawMessage);
+    this->rawSize = (this->current.msgSize < this->rawCapacity) ? this->current.msgSize : this->rawCapacity;
+#endif
+#ifdef SML_FRAME_TEMPLATE
+    // next message is compared with this one (see readSMLByte())
+    this->parser.lastMessage = (this->current.state == SML_FINAL) ? this->rawMessage : NULL;
+    this->parser.lastSize = this->rawSize;
+#endif
+#ifdef SML_CAPTURE_BYTES
+    captureMessage(&this->capture, this->current, this->rawMessage, this->rawSize);
+#endif
+#ifdef SML_AGGREGATE_WINDOWS
+    aggregateReadings(&this->aggregates, this->current);
+#endif
+    this->seq.store(seq + 2, std::memory_order_release);
+#ifdef SML_RAW_COPY
+    if (this->current.state == SML_FINAL)
+        this->adaptFrameBuffers(this->current.msgSize);
+#endif
+}
+
+
+#ifdef SML_RAW_COPY
+// fit raw buffers to the messages of this smart meter, only called by
+// the reader task between two messages; buffers grow with the first
+// truncated message (retried once per window if the pool is exhausted)
+void SMLReader::adaptFrameBuffers(uint16_t msgSize) {
+    if (msgSize > this->rawWindowMax)
+        this->rawWindowMax = msgSize;
+    if (msgSize > this->rawCapacity && !this->rawResizeFailed) {
+        this->rawResizeFailed = !this->resizeFrameBuffers(msgSize);
+    } else if (++this->rawWindowFrames >= SML_FRAME_RESIZE_FRAMES) {
+        if (this->rawWindowMax + SML_FRAME_BLOCK_SIZE <= this->rawCapacity)
+            this->resizeFrameBuffers(this->rawWindowMax);
+        this->rawWindowMax = 0;
+        this->rawWindowFrames = 0;
+        this->rawResizeFailed = false;
+    }
+}
+
+
+// replace raw buffers of parser and snapshot with buffers of given size
+// borrowed from frame pool in one piece, the snapshot is kept (truncated
+// if needed); if the pool can't hold old and new buffers at once, larger
+// buffers are borrowed after returning the old ones (losing the snapshot)
+bool SMLReader::resizeFrameBuffers(uint16_t size) {
+    uint16_t capacity = (size + SML_FRAME_BLOCK_SIZE - 1) / SML_FRAME_BLOCK_SIZE * SML_FRAME_BLOCK_SIZE;
+    uint16_t bytes = capacity * 2, oldCapacity = this->rawCapacity;
+    char *buf = borrowFrameBuffer(&bytes), *oldBuf = this->rawBuffer;
+    uint32_t seq;
+
+    if (buf == NULL) {
+        if (capacity <= oldCapacity)
+            return false;  // keep larger buffers
+        if (oldCapacity > 0) {
+            this->releaseFrameBuffers();
+            if (this->resizeFrameBuffers(size))
+                return true;
+            this->resizeFrameBuffers(oldCapacity);
+            return false;
         }
-        data++;
+        logWarnAt(&this->parser.logSites[SML_LOG_FRAME_POOL],
+            "Frame pool exhausted on pin %d (%d bytes requested, %d free)",
+            this->pin, capacity * 2, framePoolFree());
+        return false;
     }
+
+    seq = this->seq.load(std::memory_order_relaxed);
+    this->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (this->rawSize > capacity)
+        this->rawSize = capacity;
+    if (this->rawSize > 0)
+        memcpy(buf, this->rawMessage, this->rawSize);
+    this->rawMessage = buf;
+    this->rawBuffer = buf;
+    this->rawCapacity = capacity;
+    this->seq.store(seq + 2, std::memory_order_release);
+
+    this->parser.rawMessage = buf + capacity;
+    this->parser.rawCapacity = capacity;
+#ifdef SML_FRAME_TEMPLATE
+    this->parser.lastMessage = NULL;
+#endif
+    returnFrameBuffer(oldBuf, oldCapacity * 2);
+    logDebug("Raw frame buffers on pin %d resized from %d to %d bytes (%d bytes free)",
+        this->pin, oldCapacity, capacity, framePoolFree());
+    return true;
+}
+
+
+// return raw buffers of parser and snapshot to frame pool
+void SMLReader::releaseFrameBuffers() {
+    uint32_t seq;
+
+    if (this->rawCapacity == 0)
+        return;
+    seq = this->seq.load(std::memory_order_relaxed);
+    this->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    this->rawMessage = NULL;
+    this->rawSize = 0;
+    this->seq.store(seq + 2, std::memory_order_release);
+
+    returnFrameBuffer(this->rawBuffer, this->rawCapacity * 2);
+    this->rawBuffer = NULL;
+    this->parser.rawMessage = NULL;
+    this->parser.rawCapacity = 0;
+#ifdef SML_FRAME_TEMPLATE
+    this->parser.lastMessage = NULL;
+#endif
+    this->rawCapacity = 0;
 }
 #endif
 
 
+// consistent copy of last completed message without locking the reader,
+// retries if the snapshot was updated while copying (seqlock reader side)
 SMLDeviceReadings SMLReader::getReadings() {
+    SMLDeviceReadings readings;
+    uint32_t seq;
     time_t time_utc;
-    static SMLDeviceReadings readings;
 
-    readings = this->readings;
+    do {
+        seq = this->seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+        readings = this->readings;
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != this->seq.load(std::memory_order_relaxed));
 
     time(&time_utc); // eventually expire manufacturer on pin to mark missing SML readings
     if (time_utc - readings.timestamp > (SML_DATA_EXPIRE_SECS * 3))
         memset(readings.manufacturer, 0, sizeof(readings.manufacturer));
 
-    if (strlen(readings.serialnumber) == 0)
-        snprintf(readings.serialnumber, 20, "%.20d", 0);
-    else
-        readings.serialnumber[20] = '\0';
-
     return readings;
 }
 
 
+#ifdef SML_RAW_COPY
+// consistent copy of raw data of last completed message, returns its size
+uint16_t SMLReader::getRawMessage(char *buf, uint16_t size) {
+    uint16_t rawSize;
+    uint32_t seq;
+
+    do {
+        seq = this->seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+        rawSize = (this->rawSize < size) ? this->rawSize : size;
+        if (rawSize > 0)
+            memcpy(buf, this->rawMessage, rawSize);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != this->seq.load(std::memory_order_relaxed));
+
+    return rawSize;
+}
+#endif
+
+
+#ifdef SML_CAPTURE_BYTES
+// consistent copy of capture ring into buffer of SML_CAPTURE_BYTES,
+// returns its size (see capture.h for format)
+uint16_t SMLReader::getCapture(uint8_t *buf) {
+    uint16_t size;
+    uint32_t seq;
+
+    do {
+        seq = this->seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+        size = copyCapture(&this->capture, buf);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != this->seq.load(std::memory_order_relaxed));
+
+    return size;
+}
+#endif
+
+
+#ifdef SML_AGGREGATE_WINDOWS
+// copy of the window of given length (index in SML_AGGREGATE_WINDOWS)
+// closed last, returns its number (count of closed windows) or 0 if it
+// has already been committed (single consumer)
+uint32_t SMLReader::peekAggregate(uint8_t window, SMLAggregate *aggregate) {
+    uint32_t seq, closed;
+
+    do {
+        seq = this->seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+        closed = this->aggregates.closedCount[window];
+        if (closed != this->aggregatesTaken[window])
+            memcpy(aggregate, &this->aggregates.closed[window], sizeof(SMLAggregate));
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != this->seq.load(std::memory_order_relaxed));
+
+    return (closed != this->aggregatesTaken[window]) ? closed : 0;
+}
+
+
+// close windows which have ended without a message of the next one
+// (seqlock writer side like publishReadings())
+void SMLReader::closeAggregates() {
+    time_t now = time(NULL);
+    uint32_t seq;
+
+    if (!expiredAggregates(&this->aggregates, now))
+        return;
+    seq = this->seq.load(std::memory_order_relaxed);
+    this->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    ::closeAggregates(&this->aggregates, now);
+    this->seq.store(seq + 2, std::memory_order_release);
+}
+
+
+// mark window returned by peekAggregate() as published
+void SMLReader::commitAggregate(uint8_t window, uint32_t closed) {
+    this->aggregatesTaken[window] = closed;
+}
+#endif
+
+
 void SMLReader::printReadings() {
     xSemaphoreTake(SerialLock, portMAX_DELAY);
-    Serial.printf("%ld: SMLReader (Pin %d)\n", millis(), this->readings.pin);
+    Serial.printf("%ld: SMLReader (Pin %d)\n", millis(), this->pin);
+#ifdef DEBUG_SML
+    static char raw[SML_MAX_MSG_SIZE];  // protected by SerialLock
+    uint16_t rawSize = this->getRawMessage(raw, sizeof(raw));
+    printSMLReadings(this->getReadings(), raw, rawSize);
+#else
     printSMLReadings(this->getReadings());
+#endif
     xSemaphoreGive(SerialLock); 
 }
 
 
+#ifndef SML_NATIVE
 void SMLReader::readingTask() {
-    time_t last = 0;
     vTaskDelay(100/portTICK_PERIOD_MS);
-    Serial.printf("%ld: Starting SMLReader task for pin %d\n", millis(), this->readings.pin);
+    logInfo("Starting SMLReader task for pin %d", this->pin);
     while(1) {
+        // sleep until rx handler signals incoming data, parse immediately
+        ulTaskNotifyTake(pdTRUE, SML_READER_WAIT_MS / portTICK_PERIOD_MS);
         this->read();
-        if ((millis() - last) > 5000) {
-            last = millis();
-            printFreeStackWatermark("smlreader_task");
-        }
-        vTaskDelay(random(SML_READER_INTERVAL_MS-500,SML_READER_INTERVAL_MS+500)/portTICK_PERIOD_MS);
     }
 }
 
@@ -125,7 +462,6 @@ void SMLReader::printerTask() {
     vTaskDelay(2000/portTICK_PERIOD_MS);
     while(1) {
         this->printReadings();
-        printFreeStackWatermark("smlprinter_task");
         vTaskDelay((SML_PRINT_INTERVAL_SECS * 1000)/portTICK_PERIOD_MS);
     }
 }
@@ -138,7 +474,7 @@ void SMLReader::printerTaskWrapper(void* _this) {
 
 void SMLReader::startPrinter() {
     char taskName[48];
-    sprintf(taskName, "SMLReader print data task (Pin %d)", this->readings.pin);
+    sprintf(taskName, "smlprinter_%d", this->pin);
     xTaskCreate(this->printerTaskWrapper, taskName, 3072, this, 1, NULL);
     delay(100);
 }
@@ -151,7 +487,65 @@ void SMLReader::readingTaskWrapper(void* _this) {
 
 void SMLReader::startReader() {
     char taskName[48];
-    sprintf(taskName, "SMLReader serial read task (Pin %d)", this->readings.pin);
-    xTaskCreate(this->readingTaskWrapper, taskName, 2048, this, 5, NULL);
+    sprintf(taskName, "smlreader_%d", this->pin);
+    xTaskCreate(this->readingTaskWrapper, taskName, 2048, this, 5, &this->readerTask);
+    delay(100);
+}
+
+
+// single task servicing all reading heads round-robin, heads signaling
+// incoming data are served first (at most SML_SCHEDULER_BUDGET bytes
+// per turn) and all heads are checked if no signal was received
+void SMLReader::schedulerTask(void* parameter) {
+    std::list<SMLReader*>::iterator it;
+    bool pending;
+
+    vTaskDelay(100/portTICK_PERIOD_MS);
+    logInfo("Starting SMLReader scheduler task for %d pins", (int)smlreaderList->size());
+    while (1) {
+        if (ulTaskNotifyTake(pdTRUE, SML_READER_WAIT_MS / portTICK_PERIOD_MS) == 0) {
+            for (it = smlreaderList->begin(); it != smlreaderList->end(); ++it)
+                (*it)->rxPending = true;
+        }
+        do {
+            pending = false;
+            for (it = smlreaderList->begin(); it != smlreaderList->end(); ++it) {
+                if (!(*it)->rxPending)
+                    continue;
+                (*it)->rxPending = false;
+                if ((*it)->read(SML_SCHEDULER_BUDGET)) {
+                    (*it)->rxPending = true;
+                    pending = true;
+                }
+            }
+        } while (pending);
+    }
+}
+
+
+void SMLReader::schedulerPrinterTask(void* parameter) {
+    std::list<SMLReader*>::iterator it;
+
+    vTaskDelay(2000/portTICK_PERIOD_MS);
+    while (1) {
+        for (it = smlreaderList->begin(); it != smlreaderList->end(); ++it)
+            (*it)->printReadings();
+        vTaskDelay((SML_PRINT_INTERVAL_SECS * 1000)/portTICK_PERIOD_MS);
+    }
+}
+
+
+// alternative to startReader() and startPrinter(): one reader and one
+// printer task for all reading heads in smlreaderList, so task stacks
+// don't grow with the number of reading heads
+void SMLReader::startScheduler() {
+    std::list<SMLReader*>::iterator it;
+    TaskHandle_t scheduler = NULL;
+
+    xTaskCreate(schedulerTask, "smlscheduler", 2560, NULL, 5, &scheduler);
+    for (it = smlreaderList->begin(); it != smlreaderList->end(); ++it)
+        (*it)->readerTask = scheduler;
+    xTaskCreate(schedulerPrinterTask, "smlprinter", 3072, NULL, 1, NULL);
     delay(100);
 }
+#endif
\ No newline at end of file
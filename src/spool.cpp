@@ -0,0 +1,242 @@
+/***************************************************************************
+  Copyright (c) 2023 Lars Wessels
+
+  This file a part of the "ESP32-SML-Multi-Reader" source code.
+  https://github.com/lrswss/esp32-sml-multi-reader
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include <LittleFS.h>
+#include "spool.h"
+#include "obisregistry.h"
+#include "utils.h"
+#include "log.h"
+
+#define SPOOL_MAGIC 0x5350
+
+// readings are stored in a ring file of MQTT_SPOOL_RECORDS fixed-size
+// records which is only grown up to its final size and overwritten in
+// place afterwards; 'head' is the sequence number of the next record to
+// be written and 'tail' of the next one to be drained, the position of
+// a record in the file is its sequence number modulo the ring size
+static SpoolRecord pending[MQTT_SPOOL_BATCH];
+static uint8_t numPending = 0;
+static uint32_t firstPendingMillis = 0;
+static uint32_t head = 0;  // without pending records
+static uint32_t tail = 0;
+static uint32_t savedTail = 0;
+static uint32_t dropped = 0;
+static uint32_t layout = 0;
+static bool spoolReady = false;
+
+
+// FNV-1a hash of record size and name and unit of all registry slots,
+// changes if a firmware update or data/obis.json moves values to other
+// slots or changes the size of a record
+static uint32_t spoolLayout() {
+    const OBISValueSlot *slot;
+    uint32_t hash = 2166136261UL, size = sizeof(SpoolRecord);
+    uint8_t i;
+    const char *c;
+
+    for (i = 0; i < sizeof(size); i++)
+        hash = (hash ^ ((size >> (8 * i)) & 0xff)) * 16777619UL;
+    for (i = 0; i < obisRegistrySlots(); i++) {
+        slot = obisRegistrySlot(i);
+        for (c = slot->name; *c; c++)
+            hash = (hash ^ (uint8_t)*c) * 16777619UL;
+        hash = (hash ^ slot->unit) * 16777619UL;
+        hash = (hash ^ (uint8_t)slot->scale) * 16777619UL;
+    }
+    return hash;
+}
+
+
+static void saveState() {
+    File file = LittleFS.open(MQTT_SPOOL_STATE_FILE, "w");
+
+    if (file) {
+        file.write((uint8_t*)&tail, sizeof(tail));
+        file.close();
+        savedTail = tail;
+    }
+}
+
+
+// restore ring position from sequence numbers of stored records
+// and number of records already drained from state file; the queue is
+// discarded if it was written with another record layout
+bool startSpool() {
+    SpoolRecord rec;
+    uint32_t records, i;
+    bool stale = false;
+    File file;
+
+    if (!LittleFS.begin(true)) {
+        logWarn("Failed to mount LittleFS, outage queue disabled");
+        return false;
+    }
+    if (!LittleFS.exists(MQTT_SPOOL_FILE)) {
+        file = LittleFS.open(MQTT_SPOOL_FILE, "w");
+        file.close();
+    }
+
+    file = LittleFS.open(MQTT_SPOOL_FILE, "r");
+    if (!file) {
+        logWarn("Failed to open %s, outage queue disabled", MQTT_SPOOL_FILE);
+        return false;
+    }
+    layout = spoolLayout();
+    records = file.size() / sizeof(SpoolRecord);
+    stale = (file.size() % sizeof(SpoolRecord) != 0);
+    for (i = 0; i < records && !stale; i++) {
+        file.seek(i * sizeof(SpoolRecord));
+        if (file.read((uint8_t*)&rec, sizeof(rec)) != sizeof(rec) || rec.magic != SPOOL_MAGIC)
+            continue;
+        if (rec.layout != layout)
+            stale = true;
+        else if (rec.seq >= head)
+            head = rec.seq + 1;
+    }
+    file.close();
+
+    if (stale) {
+        logWarn("Outage queue discarded, OBIS registry or firmware changed");
+        file = LittleFS.open(MQTT_SPOOL_FILE, "w");
+        file.close();
+        LittleFS.remove(MQTT_SPOOL_STATE_FILE);
+        head = 0;
+    }
+
+    file = LittleFS.open(MQTT_SPOOL_STATE_FILE, "r");
+    if (file) {
+        file.read((uint8_t*)&tail, sizeof(tail));
+        file.close();
+    }
+    if (tail > head || head - tail > MQTT_SPOOL_RECORDS)  // stale state
+        tail = (head > MQTT_SPOOL_RECORDS) ? head - MQTT_SPOOL_RECORDS : 0;
+    savedTail = tail;
+    spoolReady = true;
+
+    logInfo("Outage queue with %d/%d readings", head - tail, MQTT_SPOOL_RECORDS);
+    return true;
+}
+
+
+// queue readings in RAM, written to flash once MQTT_SPOOL_BATCH records
+// are pending; oldest readings are dropped if the queue is full
+void spoolReadings(const SMLDeviceReadings &data, uint32_t values, bool partial) {
+    SpoolRecord *rec;
+
+    if (!spoolReady)
+        return;
+    if (numPending >= MQTT_SPOOL_BATCH)
+        flushSpool(true);
+    if (numPending == 0)
+        firstPendingMillis = millis();
+
+    rec = &pending[numPending++];
+    memset(rec, 0, sizeof(SpoolRecord));
+    rec->magic = SPOOL_MAGIC;
+    rec->layout = layout;
+    rec->partial = partial;
+    rec->values = values;
+    rec->data = data;
+    flushSpool(false);
+}
+
+
+// write pending records to ring file (if forced, batch is complete
+// or oldest pending record is older than MQTT_SPOOL_FLUSH_SECS)
+void flushSpool(bool force) {
+    uint32_t pos, n, j;
+    uint8_t i = 0;
+    File file;
+
+    if (numPending == 0 || (!force && numPending < MQTT_SPOOL_BATCH &&
+            (millis() - firstPendingMillis) < MQTT_SPOOL_FLUSH_SECS * 1000))
+        return;
+
+    file = LittleFS.open(MQTT_SPOOL_FILE, "r+");
+    if (!file) {
+        logWarn("Failed to write %d readings to outage queue", numPending);
+        numPending = 0;
+        return;
+    }
+    while (i < numPending) {  // consecutive records up to end of ring with a single write
+        pos = head % MQTT_SPOOL_RECORDS;
+        n = numPending - i;
+        if (n > MQTT_SPOOL_RECORDS - pos)
+            n = MQTT_SPOOL_RECORDS - pos;
+        for (j = 0; j < n; j++)
+            pending[i + j].seq = head++;
+        file.seek(pos * sizeof(SpoolRecord));
+        file.write((uint8_t*)&pending[i], n * sizeof(SpoolRecord));
+        i += n;
+    }
+    file.close();
+    numPending = 0;
+
+    if (head - tail > MQTT_SPOOL_RECORDS) {  // oldest records overwritten
+        dropped += head - tail - MQTT_SPOOL_RECORDS;
+        tail = head - MQTT_SPOOL_RECORDS;
+        saveState();
+        logWarn("Outage queue full, %d readings dropped so far", dropped);
+    }
+}
+
+
+// oldest record not yet drained, pending records are written first
+bool peekSpool(SpoolRecord *rec) {
+    File file;
+    bool found;
+
+    if (!spoolReady)
+        return false;
+    flushSpool(true);
+    if (tail == head)
+        return false;
+
+    file = LittleFS.open(MQTT_SPOOL_FILE, "r");
+    if (!file)
+        return false;
+    file.seek((tail % MQTT_SPOOL_RECORDS) * sizeof(SpoolRecord));
+    found = (file.read((uint8_t*)rec, sizeof(SpoolRecord)) == sizeof(SpoolRecord) &&
+        rec->magic == SPOOL_MAGIC && rec->layout == layout && rec->seq == tail);
+    file.close();
+    if (!found)  // skip corrupted record
+        popSpool();
+    return found;
+}
+
+
+// mark oldest record as drained
+void popSpool() {
+    if (tail == head)
+        return;
+    tail++;
+    if (tail == head || (tail - savedTail) >= MQTT_SPOOL_STATE_INTERVAL)
+        saveState();
+}
+
+
+uint32_t spooledReadings() {
+    return head - tail + numPending;
+}
+
+
+uint32_t droppedReadings() {
+    return dropped;
+}
@@ -19,7 +19,6 @@
 ***************************************************************************/
 
 #include "utils.h"
-#include "rtc.h"
 #include "config.h"
 
 SemaphoreHandle_t SerialLock;
@@ -28,10 +27,23 @@ SemaphoreHandle_t SerialLock;
 // turn array of given length into a null-terminated hex string
 void arr2str(const char *arr, int len, char *buf) {
     for (int i = 0; i < len; i++)
-        sprintf(buf + i * 2, "%02X", arr[i]);
+        sprintf(buf + i * 2, "%02X", (uint8_t)arr[i]);
 }
 
 
+// returns given string without spaces
+char* removeSpaces(char *str) {
+    uint8_t i = 0, j = 0;
+    while (str[i++]) {
+        if (str[i-1] != ' ')
+        str[j++] = str[i-1];
+    }
+    str[j] = '\0';
+    return str;
+}
+
+
+#ifndef SML_NATIVE
 // blink LED
 void blinkLED(uint8_t repeat, uint16_t pause) {
     for (uint8_t i = 0; i < repeat; i++) {
@@ -44,32 +56,12 @@ void blinkLED(uint8_t repeat, uint16_t pause) {
 }
 
 
-// for debugging stack size of tasks
-void printFreeStackWatermark(const char *taskName) {
-#ifdef DEBUG_MEMORY
-    Serial.printf("[DEBUG] %s: StackHighWaterMark: %d\n", taskName, uxTaskGetStackHighWaterMark(NULL));
-#endif
-}
-
-
 // turn LED on or off
 void switchLED(bool state) {
     digitalWrite(LED_PIN, !state ? HIGH : LOW);
 }
 
 
-// returns given string without spaces
-char* removeSpaces(char *str) {
-    uint8_t i = 0, j = 0;
-    while (str[i++]) {
-        if (str[i-1] != ' ')
-        str[j++] = str[i-1];
-    }
-    str[j] = '\0';
-    return str;
-}
-
-
 // returns hardware system id (ESP's chip id)
 String systemID() {
     uint8_t mac[6];
@@ -93,14 +85,4 @@ void stopWatchdog() {
     esp_task_wdt_delete(NULL);
     esp_task_wdt_deinit();
 }
-
-
-void debugTask(void* parameter) {
-    while (1) {
-        xSemaphoreTake(SerialLock, portMAX_DELAY);
-        Serial.printf("[DEBUG] runtime: %s, free heap: %d\n", getRuntime(), ESP.getFreeHeap());
-        printFreeStackWatermark("debug_task");
-        xSemaphoreGive(SerialLock); 
-        vTaskDelay(5000 / portTICK_PERIOD_MS);
-    }
-}
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -21,6 +21,7 @@
 
 #include "wlan.h"
 #include "utils.h"
+#include "log.h"
 #include "rtc.h"
 
 WiFiManager wm;
@@ -28,20 +29,18 @@ WiFiManager wm;
 // vTask to check Wifi connection every WIFI_CHECK_SECS
 // if connection is down retry every WIFI_RETRY_SECS
 static void wifiConnectionTask(void* parameter) {
-    Serial.printf("%ld: Starting WiFi reconnect task with interval %d secs\n", millis(), WIFI_CHECK_SECS);
+    logInfo("Starting WiFi reconnect task with interval %d secs", WIFI_CHECK_SECS);
     while (1) {
         if (WiFi.status() == WL_CONNECTED) {
             switchLED(false);
             if (millis() > (WIFI_CHECK_SECS * 1000)) {
-                Serial.printf("%ld: Uplink to SSID %s ready (RSSI %d dBm)\n", 
-                    millis(), WiFi.SSID().c_str(), WiFi.RSSI());
+                logInfo("Uplink to SSID %s ready (RSSI %d dBm)", WiFi.SSID().c_str(), WiFi.RSSI());
             }
             timeClient.update();
         } else {
             switchLED(true);
             wifiReconnect();
         }
-        printFreeStackWatermark("wificonnect_task");
         vTaskDelay((WIFI_RETRY_SECS * 1000) / portTICK_PERIOD_MS);
     }
 }
@@ -68,20 +67,18 @@ void startWifi() {
         ESP.restart();
     }
     Serial.printf("WiFi: RSSI %d dBm\n", WiFi.RSSI());
-    xTaskCreate(wifiConnectionTask, "WiFi reconnect task", 2048, NULL, 2, NULL);
+    xTaskCreate(wifiConnectionTask, "wificonnect", 2048, NULL, 2, NULL);
     blinkLED(4, 100);
 }
 
 
 void wifiReconnect() {
-    xSemaphoreTake(SerialLock, portMAX_DELAY);
-    Serial.printf("%ld: Trying to reconnect to SSID %s...", millis(), WiFi.SSID().c_str());
+    logInfo("Trying to reconnect to SSID %s...", WiFi.SSID().c_str());
     if (WiFi.reconnect()) {
-        Serial.println(F("OK"));
+        logInfo("Reconnected to SSID %s", WiFi.SSID().c_str());
         switchLED(false);
     } else {
-        Serial.println(F("failed!"));
+        logWarn("Reconnecting to SSID %s failed!", WiFi.SSID().c_str());
         switchLED(true);
     }
-    xSemaphoreGive(SerialLock); 
 }
\ No newline at end of file